@@ -0,0 +1,364 @@
+/****************************************************************************************
+    benchmark.cpp
+
+    - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    Instructions:
+    1) Build with "make benchmark.out" (or "make" for both programs)
+    2) Run "./benchmark.out > bench.json" for the full sweep, or add "--quick" for a sweep
+       that finishes in a minute or two. "--max-customers N" and "--max-months N" trim the
+       sweeps, "--shards N" runs the scenarios on the sharded engine and "--no-output"
+       skips the transaction log.
+    - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    Microbenchmarks of the per-event building blocks (ServeCustomer/ReleaseCustomer,
+    ReInitializeCustomer, GetDateTime and its allocation-free AppendDateTime), then
+    end-to-end scenarios sweeping the number of customers, months and services. Every
+    scenario runs in a child process so its peak RSS is its own. The results are printed
+    as one JSON object so runs on different commits can be compared.
+****************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "simulation.h"
+#include "sharded_simulation.h"
+#include "thread_pool.h"
+#include "transaction_log.h"
+
+const char* benchmark_log_path = "output_files/benchmark_transactions.bin";
+const int min_events_per_customer_month = 30;      // a customer starts a session at least every other day
+
+volatile long long benchmark_sink;      // keeps the optimizer from dropping benchmarked work
+
+inline double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*--------------------------------MICROBENCHMARKS--------------------------------*/
+struct MicroResult {
+    std::string name;
+    long long iterations;
+    double ns_per_op;
+};
+
+// one customer released and another served per iteration, at a service that stays half full (no queue)
+MicroResult BenchServeRelease(long long iterations) {
+    const int accounts = 300;
+    const int num = 1 << 16;
+    CustomerTable customers(num);
+    CustomerSampler sampler(1, 0, ServiceShares(SimulationConfig()));
+    for (int i = 0; i < customers.Size(); i++)
+        customers.ReInitializeCustomer(i, sampler, 0);
+    StreamingService service(accounts, 9.99, "Bench");
+    long long served = 0;
+    int time = 0;
+    for (int i = 0; i < accounts / 2; i++)
+        served += service.ServeCustomer(customers, i, time);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < iterations; n++) {
+        int cust = (int)((accounts / 2 + n) & (num - 1));
+        int leaving = service.NextDeparting();
+        if (leaving != -1) {
+            time = std::max(time, service.NextDeparture());
+            Session ended;
+            service.ReleaseCustomer(customers, leaving, time, sampler, ended);
+            served += ended.cust_id;
+        }
+        served += service.ServeCustomer(customers, cust, time);
+    }
+    double seconds = SecondsSince(start);
+    benchmark_sink = served;
+    return {"ServeCustomer+ReleaseCustomer", iterations, seconds * 1e9 / iterations};
+}
+
+// one customer released (taking the front of the queue with it), one served and one queued per
+// iteration, at a full service whose queue stays 64 long
+MicroResult BenchQueuedServeRelease(long long iterations) {
+    const int accounts = 300;
+    const int queued = 64;
+    const int num = 1 << 16;
+    CustomerTable customers(num);
+    CustomerSampler sampler(1, 0, ServiceShares(SimulationConfig()));
+    for (int i = 0; i < customers.Size(); i++)
+        customers.ReInitializeCustomer(i, sampler, 0);
+    StreamingService service(accounts, 9.99, "Bench");
+    long long served = 0;
+    int time = 0;
+    for (int i = 0; i < accounts + queued; i++)
+        served += service.ServeCustomer(customers, i, time);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < iterations; n++) {
+        int cust = (int)((accounts + queued + 2*n) & (num - 1));
+        int leaving = service.NextDeparting();
+        if (leaving != -1) {
+            time = std::max(time, service.NextDeparture());
+            Session ended;
+            served += service.ReleaseCustomer(customers, leaving, time, sampler, ended) >= 0;
+        }
+        served += service.ServeCustomer(customers, cust, time);
+        served += service.ServeCustomer(customers, (cust + 1) & (num - 1), time);
+    }
+    double seconds = SecondsSince(start);
+    benchmark_sink = served;
+    return {"ServeCustomer+ReleaseCustomer (queued)", iterations, seconds * 1e9 / iterations};
+}
+
+MicroResult BenchReInitialize(long long iterations) {
+    const int num = 1 << 16;
+    CustomerTable customers(num);
+    CustomerSampler sampler(1, 0, ServiceShares(SimulationConfig()));
+    auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < iterations; n++)
+        customers.ReInitializeCustomer((int)(n & (num - 1)), sampler, (int)(n & 0xFFFFF));
+    double seconds = SecondsSince(start);
+    long long sum = 0;
+    for (int i = 0; i < num; i++)
+        sum += customers.arrival_time[i] + customers.service_time[i] + customers.chosen_service[i];
+    benchmark_sink = sum;
+    return {"ReInitializeCustomer", iterations, seconds * 1e9 / iterations};
+}
+
+MicroResult BenchGetDateTime(long long iterations) {
+    long long length = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < iterations; n++)
+        length += StreamingService::GetDateTime((int)(n % (month_min*num_months))).size();
+    double seconds = SecondsSince(start);
+    benchmark_sink = length;
+    return {"GetDateTime", iterations, seconds * 1e9 / iterations};
+}
+
+MicroResult BenchAppendDateTime(long long iterations) {
+    char buffer[32];
+    long long length = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long long n = 0; n < iterations; n++)
+        length += AppendDateTime(buffer, (int)(n % (month_min*num_months)), month_min) - buffer;
+    double seconds = SecondsSince(start);
+    benchmark_sink = length;
+    return {"AppendDateTime", iterations, seconds * 1e9 / iterations};
+}
+/*-------------------------------------------------------------------------------*/
+
+
+/*--------------------------------SCENARIOS--------------------------------*/
+struct Scenario {
+    std::string sweep;          // which dimension the scenario belongs to
+    int num_customers;
+    int num_months;
+    int num_services;
+};
+
+struct ScenarioResult {
+    long long events;
+    double seconds;
+    long long output_bytes;
+    long long peak_rss_kb;
+    bool ok;
+    int windows;            // sharded engine only: windows handled, rolled back and handled on one thread
+    int rollbacks;
+    int serial;
+};
+
+// num_services services cycling through the default catalog, with accounts scaled so each
+// service carries the same load per account as the default model with 10000 customers. The
+// customers' first arrivals are spread over the default model's first 10000 minutes; one minute
+// apart, the customers past the end of a short horizon would never arrive.
+SimulationConfig ScenarioConfig(const Scenario& scenario) {
+    SimulationConfig config;
+    config.num_customers = scenario.num_customers;
+    config.num_months = scenario.num_months;
+    config.arrival_spacing = std::min(1.0, (double)::num_customers / scenario.num_customers);
+    config.services.clear();
+    config.accounts.clear();
+    double total_share = 0;
+    for (int i = 0; i < scenario.num_services; i++)
+        total_share += service_shares[i % num_services];
+    for (int i = 0; i < scenario.num_services; i++) {
+        int base = i % num_services;
+        std::string name = service_names[base];
+        if (i >= num_services)
+            name += " " + std::to_string(i / num_services + 1);
+        config.services.push_back({name, service_costs[base], service_shares[base]});
+        double load = (double)scenario.num_customers / ::num_customers * service_shares[base] / total_share;
+        config.accounts.push_back(std::max(1, (int)(service_accounts[base] / service_shares[base] * load + 0.5)));
+    }
+    return config;
+}
+
+// run one scenario in this process
+ScenarioResult RunScenario(const Scenario& scenario, int num_shards, bool write_output) {
+    ScenarioResult result = {0, 0, 0, 0, true, 0, 0, 0};
+    SimulationConfig config = ScenarioConfig(scenario);
+    TransactionLogWriter* log = NULL;
+    if (write_output) {
+        std::vector<std::string> names = config.ServiceNames();
+        log = new TransactionLogWriter(benchmark_log_path, names, month_min);
+        if (!log->IsOpen()) {
+            delete log;
+            log = NULL;
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    int last_arrival;
+    if (num_shards > 1) {
+        ThreadPool pool(num_shards);
+        ShardedSimulation sharded(1, 0, config, num_shards, log);
+        sharded.Run(pool);
+        result.events = sharded.sim.num_events;
+        result.windows = sharded.num_windows;
+        result.rollbacks = sharded.num_rollbacks;
+        result.serial = sharded.num_serial;
+        last_arrival = sharded.sim.arrival_of_last_customer;
+    }
+    else {
+        Simulation sim(1, 0, config, log);
+        sim.Run();
+        result.events = sim.num_events;
+        last_arrival = sim.arrival_of_last_customer;
+    }
+    if (log != NULL) {
+        log->Close();
+        result.output_bytes = log->BytesWritten();
+        delete log;
+        remove(benchmark_log_path);
+    }
+    result.seconds = SecondsSince(start);
+
+    // every customer must have arrived and kept coming back, or the scenario does not measure its size
+    long long min_events = (long long)min_events_per_customer_month * scenario.num_customers * scenario.num_months;
+    if (last_arrival >= scenario.num_months * month_min || result.events < min_events) {
+        fprintf(stderr, "%s: %lld events, expected at least %lld (last first arrival at minute %d)\n",
+                scenario.sweep.c_str(), result.events, min_events, last_arrival);
+        result.ok = false;
+    }
+    return result;
+}
+
+// run one scenario in a child process and collect its peak RSS
+ScenarioResult RunScenarioIsolated(const Scenario& scenario, int num_shards, bool write_output) {
+    ScenarioResult result = {0, 0, 0, 0, false, 0, 0, 0};
+    int fds[2];
+    if (pipe(fds) != 0)
+        return result;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return result;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ScenarioResult child = RunScenario(scenario, num_shards, write_output);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == (ssize_t)sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    wait4(pid, &status, 0, &usage);
+    if (got != (ssize_t)sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        result.ok = false;
+        return result;
+    }
+    result.peak_rss_kb = usage.ru_maxrss;       // kilobytes on Linux
+    return result;
+}
+/*-------------------------------------------------------------------------*/
+
+
+int main(int argc, char* argv[]) {
+    bool quick = false;
+    bool write_output = true;
+    int num_shards = 1;
+    int max_customers = 10000000;
+    int max_months = 24;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = true;
+        else if (strcmp(argv[i], "--no-output") == 0)
+            write_output = false;
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+            num_shards = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--max-customers") == 0 && i + 1 < argc)
+            max_customers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-months") == 0 && i + 1 < argc)
+            max_months = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--quick] [--no-output] [--shards N] [--max-customers N] [--max-months N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (quick) {
+        max_customers = std::min(max_customers, 100000);
+        max_months = std::min(max_months, 6);
+    }
+
+    std::vector<MicroResult> micro;
+    long long scale = quick ? 1 : 10;
+    micro.push_back(BenchServeRelease(2000000 * scale));
+    micro.push_back(BenchQueuedServeRelease(2000000 * scale));
+    micro.push_back(BenchReInitialize(2000000 * scale));
+    micro.push_back(BenchGetDateTime(200000 * scale));
+    micro.push_back(BenchAppendDateTime(2000000 * scale));
+
+    std::vector<Scenario> scenarios;
+    const int customer_counts[] = {10000, 100000, 1000000, 10000000};
+    for (int c : customer_counts) {
+        if (c <= max_customers)
+            scenarios.push_back({"customers", c, 2, num_services});
+    }
+    const int month_counts[] = {1, 2, 6, 12, 24};
+    for (int m : month_counts) {
+        if (m <= max_months)
+            scenarios.push_back({"months", 10000, m, num_services});
+    }
+    const int service_counts[] = {6, 12, 24, 50, 100};
+    for (int s : service_counts) {
+        if (!quick || s <= 24)
+            scenarios.push_back({"services", std::min(max_customers, 100000), 2, s});
+    }
+
+    printf("{\n");
+    printf("  \"compiler\": \"%s\",\n", __VERSION__);
+    printf("  \"hardware_threads\": %d,\n", ThreadPool::DefaultThreads());
+    printf("  \"shards\": %d,\n", num_shards);
+    printf("  \"micro\": [\n");
+    for (size_t i = 0; i < micro.size(); i++) {
+        printf("    {\"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.2f}%s\n",
+               micro[i].name.c_str(), micro[i].iterations, micro[i].ns_per_op, i + 1 < micro.size() ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"scenarios\": [\n");
+    bool all_ok = true;
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        const Scenario& s = scenarios[i];
+        fprintf(stderr, "%s: %d customers, %d months, %d services\n", s.sweep.c_str(), s.num_customers, s.num_months, s.num_services);
+        ScenarioResult r = RunScenarioIsolated(s, num_shards, write_output);
+        all_ok = all_ok && r.ok;
+        printf("    {\"sweep\": \"%s\", \"num_customers\": %d, \"num_months\": %d, \"num_services\": %d, \"ok\": %s, "
+               "\"events\": %lld, \"seconds\": %.4f, \"events_per_sec\": %.0f, \"ns_per_event\": %.2f, "
+               "\"peak_rss_kb\": %lld, \"output_bytes\": %lld, \"windows\": %d, \"rollbacks\": %d, \"serial_windows\": %d}%s\n",
+               s.sweep.c_str(), s.num_customers, s.num_months, s.num_services, r.ok ? "true" : "false",
+               r.events, r.seconds, r.seconds > 0 ? r.events / r.seconds : 0, r.events > 0 ? r.seconds * 1e9 / r.events : 0,
+               r.peak_rss_kb, r.output_bytes, r.windows, r.rollbacks, r.serial, i + 1 < scenarios.size() ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n");
+    printf("}\n");
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+/****************************************************************************************
+    capacity_search.h
+
+    Finds the cheapest number of accounts for each streaming service that still meets a
+    delay service level (the probability that one of the service's own arrivals queues,
+    and the maximum queue time). The services'
+    queues are nearly independent, so one candidate account vector tests every service
+    at once and all services are searched in lockstep: gallop up until a count passes,
+    then bisect between the largest failing and the smallest passing count. Each round
+    runs one candidate per pool thread, and a candidate stops taking replications as
+    soon as every service it is still testing has clearly passed or clearly failed. The
+    chosen counts are checked with the full number of replications, and a service that
+    fails that check is searched again above its count.
+    With a surrogate model the search starts at the count predicted to just meet the
+    probability of queue target, and counts predicted to miss it by a wide margin are
+    taken as failing without being simulated.
+****************************************************************************************/
+
+#ifndef CAPACITY_SEARCH_H
+#define CAPACITY_SEARCH_H
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "simulation.h"
+#include "replication.h"
+#include "surrogate_model.h"
+#include "thread_pool.h"
+
+/*--------------------------------SERVICE LEVEL TARGET--------------------------------*/
+struct ServiceLevelTarget {
+    double max_prob_delay = 0.01;       // probability of queue of each service's own arrivals must stay below this
+    double max_delay = 10;              // maximum queue time (mins) must stay below this
+};
+
+const double surrogate_prune_factor = 3;   // counts predicted at this many times the probability target fail unsimulated
+const double surrogate_growth = 1.25;      // gallop step up from a predicted count
+const double confirmation_growth = 1.05;   // gallop step up from a count that failed the full-replication check
+const int max_confirmations = 3;           // searches whose chosen counts must pass a full-replication check
+
+// next count when galloping up by 'growth', at least one more
+inline int Grow(int count, double growth) {
+    return std::max(count + 1, (int)std::ceil(count * growth));
+}
+
+const int UNDECIDED = 0;
+const int PASSES = 1;
+const int FAILS = 2;
+
+// compare an estimate against an upper limit; it is decided once the confidence interval
+// lies entirely on one side, or on its mean when no more replications will be run
+inline int CompareToLimit(const Estimate& est, double limit, bool final) {
+    if (est.n == 0)
+        return UNDECIDED;
+    if (final)
+        return est.mean < limit ? PASSES : FAILS;
+    if (std::isnan(est.half_width))
+        return UNDECIDED;
+    if (est.mean - est.half_width >= limit)
+        return FAILS;
+    if (est.mean + est.half_width < limit)
+        return PASSES;
+    return UNDECIDED;
+}
+
+// a service meets the target only if both its probability of queue and maximum queue time do
+inline int ServiceVerdict(const ServiceSummary& summary, const ServiceLevelTarget& target, bool final) {
+    int prob = CompareToLimit(summary.service_prob_delay, target.max_prob_delay, final);
+    int delay = CompareToLimit(summary.max_delay, target.max_delay, final);
+    if (prob == FAILS || delay == FAILS)
+        return FAILS;
+    if (prob == PASSES && delay == PASSES)
+        return PASSES;
+    return UNDECIDED;
+}
+/*------------------------------------------------------------------------------------*/
+
+
+/*--------------------------------CANDIDATE EVALUATION--------------------------------*/
+struct CandidateResult {
+    SimulationConfig config;                    // configuration that was simulated
+    std::vector<ServiceSummary> summary;        // merged metrics over the replications run
+    std::vector<int> verdicts;                  // PASSES or FAILS for each tested service
+    int replications = 0;                       // replications actually run
+};
+
+// simulate one account vector, adding replications until every service in 'tested' is decided
+// (after at least min_replications) or max_replications have run; replication r uses the
+// same seed for every candidate, so candidates are compared on common random numbers
+inline CandidateResult EvaluateCandidate(const SimulationConfig& config, const std::vector<bool>& tested, unsigned long long seed,
+                                         const ServiceLevelTarget& target, int min_replications, int max_replications) {
+    CandidateResult candidate;
+    candidate.config = config;
+    int num_services = config.NumServices();
+    candidate.verdicts.assign(num_services, UNDECIDED);
+    ReplicationResults results;
+    results.antithetic = config.antithetic;
+    results.control_variates = config.control_variates;
+    for (int r = 0; r < max_replications; r++) {
+        Simulation sim(seed, r, config);
+        sim.Run();
+        results.metrics.push_back(sim.Metrics());
+        candidate.replications = r + 1;
+        if (candidate.replications < min_replications || (config.antithetic && candidate.replications % 2 == 1))
+            continue;
+        candidate.summary = Summarize(results);
+        bool all_decided = true;
+        for (int i = 0; i < num_services; i++) {
+            if (tested[i] && ServiceVerdict(candidate.summary[i], target, false) == UNDECIDED)
+                all_decided = false;
+        }
+        if (all_decided)
+            break;
+    }
+    candidate.summary = Summarize(results);
+    for (int i = 0; i < num_services; i++) {
+        int verdict = ServiceVerdict(candidate.summary[i], target, false);
+        candidate.verdicts[i] = verdict != UNDECIDED ? verdict : ServiceVerdict(candidate.summary[i], target, true);
+    }
+    return candidate;
+}
+/*------------------------------------------------------------------------------------*/
+
+
+/*--------------------------------CAPACITY SEARCH--------------------------------*/
+struct CapacitySearchResult {
+    SimulationConfig config;                    // base configuration with the cheapest passing account counts
+    CandidateResult final_check;                // the chosen vector simulated with max_replications
+    int num_evaluations = 0;                    // candidate account vectors simulated during the search
+    int num_replications = 0;                   // replications simulated during the search
+    bool confirmed = false;                     // every service passed the final check
+};
+
+// search the account counts, keeping the rest of 'base' (customers, months) fixed; 'surrogate' (may be NULL)
+// brackets each service's count before anything is simulated
+inline CapacitySearchResult SearchCapacity(const SimulationConfig& base, unsigned long long seed, const ServiceLevelTarget& target, ThreadPool& pool,
+                                           int min_replications, int max_replications, std::ostream& log, const SurrogateModel* surrogate = NULL) {
+    CapacitySearchResult result;
+    int width = pool.NumThreads();              // candidates simulated per round
+    int max_count = base.num_customers;         // an account per customer never queues anyone
+    int num_services = base.NumServices();
+    std::vector<int> lo(num_services, 0);       // largest count known to fail (zero accounts never serve anyone)
+    std::vector<int> hi(num_services, -1);      // smallest count known to pass (-1 until one is found)
+    std::vector<int> start(num_services);       // first count to gallop up from
+    std::vector<double> growth(num_services, 2);    // gallop step; from a close start it steps less
+    for (int i = 0; i < num_services; i++)
+        start[i] = std::max(1, base.accounts[i]);
+
+    if (surrogate != NULL) {
+        growth.assign(num_services, surrogate_growth);
+        // predicted just-passing counts, with the other services at theirs
+        std::vector<int> predicted = base.accounts;
+        for (int i = 0; i < num_services; i++)
+            predicted[i] = surrogate->MinimumAccounts(i, target.max_prob_delay, base.accounts);
+        log << "Surrogate model:\n  start   ";
+        for (int i = 0; i < num_services; i++) {
+            start[i] = std::min(max_count, surrogate->MinimumAccounts(i, target.max_prob_delay, predicted));
+            lo[i] = std::min(start[i] - 1, surrogate->MinimumAccounts(i, target.max_prob_delay * surrogate_prune_factor, predicted) - 1);
+            log << " " << std::setw(5) << start[i];
+        }
+        log << "\n  failing ";
+        for (int i = 0; i < num_services; i++)
+            log << " " << std::setw(5) << lo[i];
+        log << "   (predicted, not simulated)\n";
+    }
+
+    int round = 1;
+    for (int search = 1; ; search++) {
+        for (; ; round++) {
+            // pick the counts to probe for each service still being searched
+            std::vector<std::vector<int>> probes(num_services);
+            bool searching = false;
+            for (int i = 0; i < num_services; i++) {
+                if (hi[i] == -1 && lo[i] >= max_count)
+                    hi[i] = max_count;              // cannot meet the target even with an account per customer
+                if (hi[i] != -1 && hi[i] - lo[i] <= 1)
+                    continue;
+                searching = true;
+                for (int m = 0; m < width; m++) {
+                    int count;
+                    if (hi[i] == -1) {              // gallop up from the start count until one passes
+                        count = lo[i] < start[i] ? start[i] : Grow(lo[i], growth[i]);
+                        for (int k = 0; k < m && count < max_count; k++)
+                            count = Grow(count, growth[i]);
+                        count = std::min(count, max_count);
+                    }
+                    else {                          // split (lo, hi) into width+1 equal parts
+                        count = lo[i] + (int)((long long)(hi[i] - lo[i]) * (m+1) / (width+1));
+                    }
+                    if (count > lo[i] && (hi[i] == -1 || count < hi[i]) && (probes[i].empty() || count != probes[i].back()))
+                        probes[i].push_back(count);
+                }
+            }
+            if (!searching)
+                break;
+
+            // build one candidate vector per probe; settled services stay at their passing count
+            int num_candidates = 0;
+            for (int i = 0; i < num_services; i++)
+                num_candidates = std::max(num_candidates, (int)probes[i].size());
+            std::vector<CandidateResult> candidates(num_candidates);
+            for (int c = 0; c < num_candidates; c++) {
+                SimulationConfig config = base;
+                std::vector<bool> tested(num_services, false);
+                for (int i = 0; i < num_services; i++) {
+                    if (probes[i].empty()) {
+                        config.accounts[i] = hi[i];
+                    }
+                    else {
+                        config.accounts[i] = probes[i][std::min(c, (int)probes[i].size() - 1)];
+                        tested[i] = c < (int)probes[i].size();
+                    }
+                }
+                pool.Submit([&candidates, c, config, tested, seed, &target, min_replications, max_replications] {
+                    candidates[c] = EvaluateCandidate(config, tested, seed, target, min_replications, max_replications);
+                });
+            }
+            pool.Wait();
+
+            // narrow each service's bracket; a verdict that contradicts a better-supported one is noise and ignored
+            log << "Round " << round << ":\n";
+            for (int c = 0; c < num_candidates; c++) {
+                result.num_evaluations++;
+                result.num_replications += candidates[c].replications;
+                log << "  accounts";
+                for (int i = 0; i < num_services; i++)
+                    log << " " << std::setw(5) << candidates[c].config.accounts[i] << (candidates[c].verdicts[i] == PASSES ? "+" : "-");
+                log << "   (" << candidates[c].replications << " replications)\n";
+                for (int i = 0; i < num_services; i++) {
+                    if (probes[i].empty() || c >= (int)probes[i].size())
+                        continue;
+                    int count = candidates[c].config.accounts[i];
+                    if (candidates[c].verdicts[i] == PASSES && count > lo[i] && (hi[i] == -1 || count < hi[i]))
+                        hi[i] = count;
+                    else if (candidates[c].verdicts[i] == FAILS && count > lo[i] && (hi[i] == -1 || count < hi[i]))
+                        lo[i] = count;
+                }
+            }
+        }
+
+        // confirm the chosen vector with the full number of replications; a count that passed on fewer
+        // replications but fails here becomes the bracket's failing end, and the search goes on above it
+        result.config = base;
+        result.config.accounts = hi;
+        std::vector<bool> none(num_services, false);
+        result.final_check = EvaluateCandidate(result.config, none, seed, target, max_replications, max_replications);
+        bool retry = false;
+        result.confirmed = true;
+        for (int i = 0; i < num_services; i++) {
+            if (result.final_check.verdicts[i] == PASSES)
+                continue;
+            result.confirmed = false;
+            if (hi[i] < max_count && search < max_confirmations) {
+                lo[i] = hi[i];
+                start[i] = hi[i] + 1;
+                hi[i] = -1;
+                growth[i] = confirmation_growth;
+                retry = true;
+            }
+        }
+        if (!retry)
+            break;
+        log << "Confirmation with " << max_replications << " replications failed; searching above the failing counts\n";
+    }
+    return result;
+}
+/*-------------------------------------------------------------------------------*/
+
+#endif
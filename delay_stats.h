@@ -0,0 +1,171 @@
+/****************************************************************************************
+    delay_stats.h
+
+    Constant-memory online statistics that a StreamingService updates in O(1) per event:
+    P-square quantile estimates of the wait time, a log-bucketed wait histogram, and
+    time-weighted averages of piecewise-constant values such as the queue length.
+****************************************************************************************/
+
+#ifndef DELAY_STATS_H
+#define DELAY_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*--------------------------------P-SQUARE QUANTILE--------------------------------*/
+// streaming estimate of one quantile with five markers (Jain & Chlamtac's P-square algorithm)
+class P2Quantile {
+    public:
+        // constructor, p is the quantile to track (0.99 for P99)
+        P2Quantile(double p = 0.5) {
+            this->p = p;
+        }
+
+        void Add(double x) {
+            if (count < 5) {
+                q[count++] = x;
+                if (count == 5) {
+                    std::sort(q, q + 5);
+                    for (int i = 0; i < 5; i++)
+                        n[i] = i;
+                    np[0] = 0; np[1] = 2*p; np[2] = 4*p; np[3] = 2 + 2*p; np[4] = 4;
+                    dn[0] = 0; dn[1] = p/2; dn[2] = p; dn[3] = (1 + p)/2; dn[4] = 1;
+                }
+                return;
+            }
+            count++;
+
+            // find the cell the observation falls in, stretching the extremes if needed
+            int k;
+            if (x < q[0]) {
+                q[0] = x;
+                k = 0;
+            }
+            else if (x >= q[4]) {
+                q[4] = x;
+                k = 3;
+            }
+            else {
+                k = 0;
+                while (k < 3 && x >= q[k+1])
+                    k++;
+            }
+            for (int i = k + 1; i < 5; i++)
+                n[i]++;
+            for (int i = 0; i < 5; i++)
+                np[i] += dn[i];
+
+            // move the three middle markers towards their desired positions
+            for (int i = 1; i < 4; i++) {
+                double d = np[i] - n[i];
+                if ((d >= 1 && n[i+1] - n[i] > 1) || (d <= -1 && n[i-1] - n[i] < -1)) {
+                    int ds = d > 0 ? 1 : -1;
+                    double qp = Parabolic(i, ds);
+                    if (q[i-1] < qp && qp < q[i+1])
+                        q[i] = qp;
+                    else
+                        q[i] = q[i] + ds * (q[i+ds] - q[i]) / (n[i+ds] - n[i]);
+                    n[i] += ds;
+                }
+            }
+        }
+
+        // current estimate, exact while fewer than five values have been seen (nan if none)
+        double Value() const {
+            if (count == 0)
+                return NAN;
+            if (count < 5) {
+                int m = (int)count;
+                double sorted[5];
+                for (int i = 0; i < m; i++) {           // insertion sort of the few values seen so far
+                    int j = i;
+                    while (j > 0 && sorted[j-1] > q[i]) {
+                        sorted[j] = sorted[j-1];
+                        j--;
+                    }
+                    sorted[j] = q[i];
+                }
+                return sorted[(int)std::round(p * (m - 1))];
+            }
+            return q[2];
+        }
+
+        long long Count() const {
+            return count;
+        }
+
+    private:
+        double p;
+        long long count = 0;
+        double q[5];                // marker heights
+        double n[5];                // marker positions (whole numbers)
+        double np[5];               // desired marker positions
+        double dn[5];               // increments of the desired positions
+
+        double Parabolic(int i, int d) const {
+            return q[i] + (double)d / (n[i+1] - n[i-1])
+                * ((n[i] - n[i-1] + d) * (q[i+1] - q[i]) / (n[i+1] - n[i]) + (n[i+1] - n[i] - d) * (q[i] - q[i-1]) / (n[i] - n[i-1]));
+        }
+};
+/*---------------------------------------------------------------------------------*/
+
+
+/*--------------------------------LOG HISTOGRAM--------------------------------*/
+// counts of non-negative integer values in power-of-two buckets:
+// bucket 0 holds 0, bucket k holds [2^(k-1), 2^k), the last bucket holds everything above
+class LogHistogram {
+    public:
+        static const int num_buckets = 20;
+
+        std::vector<long long> counts = std::vector<long long>(num_buckets, 0);
+
+        static int Bucket(int value) {
+            if (value <= 0)
+                return 0;
+            int k = 32 - __builtin_clz((unsigned int)value);
+            return std::min(k, num_buckets - 1);
+        }
+
+        // smallest value that lands in bucket k
+        static int BucketLow(int k) {
+            return k == 0 ? 0 : 1 << (k - 1);
+        }
+
+        void Add(int value) {
+            counts[Bucket(value)]++;
+        }
+        // take back an Add of the same value
+        void Remove(int value) {
+            counts[Bucket(value)]--;
+        }
+};
+/*-----------------------------------------------------------------------------*/
+
+
+/*--------------------------------TIME-WEIGHTED AVERAGE--------------------------------*/
+// average over time of a value that changes at discrete event times
+class TimeWeightedAverage {
+    public:
+        // the value changes to new_value at 'time'
+        void Update(int time, double new_value) {
+            area += value * (time - last_time);
+            last_time = time;
+            value = new_value;
+        }
+
+        // average from time 0 to end_time
+        double Mean(int end_time) const {
+            if (end_time <= 0)
+                return NAN;
+            return (area + value * (end_time - last_time)) / end_time;
+        }
+
+    private:
+        double value = 0;
+        double area = 0;
+        int last_time = 0;
+};
+/*-------------------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,355 @@
+/****************************************************************************************
+    instrumentation.h
+
+    Hot-path instrumentation. Each thread counts the calls of every engine phase and the
+    CPU cycles spent in them (rdtsc, inclusive of nested phases); each running simulation
+    publishes its simulated time, events handled and per-service queue depth and active
+    sessions every few thousand events. A MetricsReporter thread renders all of it in the
+    Prometheus text format to a file (rewritten atomically) and/or a Unix socket.
+
+    Nothing is measured until INSTRUMENTATION_ENABLED is set (by --metrics-file or
+    --metrics-socket), so a normal run pays one predictable branch per phase. Building
+    with -DSIMULATION_INSTRUMENTATION=0 compiles all of it out.
+****************************************************************************************/
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#ifndef SIMULATION_INSTRUMENTATION
+#define SIMULATION_INSTRUMENTATION 1
+#endif
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// engine phases that are timed
+const int PHASE_DISPATCH = 0;           // one event, everything below included
+const int PHASE_SERVE = 1;
+const int PHASE_RELEASE = 2;
+const int PHASE_REINITIALIZE = 3;
+const int PHASE_LOGGING = 4;            // handing a transaction to the log writer
+const int num_phases = 5;
+const char* const phase_names[num_phases] = {"dispatch", "serve", "release", "reinitialize", "logging"};
+
+inline bool INSTRUMENTATION_ENABLED = false;    // set before any simulation starts, never while one runs
+
+const int gauge_interval_events = 4096;         // a simulation publishes its gauges this often
+
+
+#if SIMULATION_INSTRUMENTATION
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+inline uint64_t ReadCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// one thread's phase counters; only that thread writes them, so plain load+store suffices
+struct alignas(64) PhaseCounters {
+    std::atomic<uint64_t> calls[num_phases];
+    std::atomic<uint64_t> cycles[num_phases];
+
+    PhaseCounters() {
+        for (int i = 0; i < num_phases; i++) {
+            calls[i].store(0, std::memory_order_relaxed);
+            cycles[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    void Add(int phase, uint64_t elapsed) {
+        calls[phase].store(calls[phase].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        cycles[phase].store(cycles[phase].load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    }
+};
+
+// what one running simulation publishes
+class SimulationGauges {
+    public:
+        int replication;
+        std::string label;                          // Prometheus labels, set by MetricsRegistry::Register
+        std::vector<std::string> service_names;
+        std::atomic<int> sys_time{0};
+        std::atomic<int> end_time{0};
+        std::atomic<long long> events{0};
+        std::unique_ptr<std::atomic<int>[]> queue_depth;
+        std::unique_ptr<std::atomic<int>[]> active_sessions;
+        // reporter-side state for the simulated minutes per second
+        bool finished = false;                      // the simulation is gone and these are its last values
+        int last_sys_time = 0;
+        std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+        double minutes_per_second = 0;
+
+        // constructor
+        SimulationGauges(int replication, const std::vector<std::string>& service_names)
+            : replication(replication), service_names(service_names),
+              queue_depth(new std::atomic<int>[service_names.size()]), active_sessions(new std::atomic<int>[service_names.size()]) {
+            for (size_t i = 0; i < service_names.size(); i++) {
+                queue_depth[i].store(0, std::memory_order_relaxed);
+                active_sessions[i].store(0, std::memory_order_relaxed);
+            }
+        }
+};
+
+// every thread's counters and every running simulation's gauges
+class MetricsRegistry {
+    public:
+        static MetricsRegistry& Instance() {
+            static MetricsRegistry registry;
+            return registry;
+        }
+
+        // the calling thread's counters, created on first use
+        PhaseCounters* ThreadCounters() {
+            thread_local PhaseCounters* counters = NULL;
+            if (counters == NULL) {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.emplace_back();
+                counters = &threads.back();
+            }
+            return counters;
+        }
+
+        void Register(SimulationGauges* gauges) {
+            std::lock_guard<std::mutex> lock(mutex);
+            gauges->label = "simulation=\"" + std::to_string(next_simulation++) + "\",replication=\"" + std::to_string(gauges->replication) + "\"";
+            simulations.push_back(gauges);
+        }
+        // the simulation is done: its gauges keep being reported with their last values, so the final
+        // report still has every simulation, and the registry frees them
+        void Unregister(SimulationGauges* gauges) {
+            std::lock_guard<std::mutex> lock(mutex);
+            gauges->finished = true;
+            gauges->minutes_per_second = 0;
+            finished.emplace_back(gauges);
+        }
+
+        // everything in the Prometheus text exposition format
+        std::string Render() {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::ostringstream out;
+            out << "# HELP sim_phase_calls_total Calls of each engine phase, per thread.\n"
+                << "# TYPE sim_phase_calls_total counter\n";
+            for (size_t t = 0; t < threads.size(); t++) {
+                for (int p = 0; p < num_phases; p++)
+                    out << "sim_phase_calls_total{thread=\"" << t << "\",phase=\"" << phase_names[p] << "\"} " << threads[t].calls[p].load(std::memory_order_relaxed) << "\n";
+            }
+            out << "# HELP sim_phase_cycles_total CPU cycles spent in each engine phase (nested phases included), per thread.\n"
+                << "# TYPE sim_phase_cycles_total counter\n";
+            for (size_t t = 0; t < threads.size(); t++) {
+                for (int p = 0; p < num_phases; p++)
+                    out << "sim_phase_cycles_total{thread=\"" << t << "\",phase=\"" << phase_names[p] << "\"} " << threads[t].cycles[p].load(std::memory_order_relaxed) << "\n";
+            }
+            out << "# HELP sim_cycles_per_second Rate of the cycle counter.\n"
+                << "# TYPE sim_cycles_per_second gauge\n"
+                << "sim_cycles_per_second " << CyclesPerSecond() << "\n";
+
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < simulations.size(); i++) {
+                SimulationGauges* g = simulations[i];
+                if (g->finished)
+                    continue;
+                int sys_time = g->sys_time.load(std::memory_order_relaxed);
+                double seconds = std::chrono::duration<double>(now - g->last_report).count();
+                if (seconds > 0.05) {
+                    g->minutes_per_second = (sys_time - g->last_sys_time) / seconds;
+                    g->last_sys_time = sys_time;
+                    g->last_report = now;
+                }
+            }
+            Family(out, "sim_minutes", "gauge", "Simulated minutes handled so far.");
+            for (size_t i = 0; i < simulations.size(); i++)
+                out << "sim_minutes{" << simulations[i]->label << "} " << simulations[i]->sys_time.load(std::memory_order_relaxed) << "\n";
+            Family(out, "sim_end_minutes", "gauge", "Simulated minute the run stops at.");
+            for (size_t i = 0; i < simulations.size(); i++)
+                out << "sim_end_minutes{" << simulations[i]->label << "} " << simulations[i]->end_time.load(std::memory_order_relaxed) << "\n";
+            Family(out, "sim_minutes_per_second", "gauge", "Simulated minutes per wall-clock second since the previous report.");
+            for (size_t i = 0; i < simulations.size(); i++)
+                out << "sim_minutes_per_second{" << simulations[i]->label << "} " << simulations[i]->minutes_per_second << "\n";
+            Family(out, "sim_events_total", "counter", "Events handled.");
+            for (size_t i = 0; i < simulations.size(); i++)
+                out << "sim_events_total{" << simulations[i]->label << "} " << simulations[i]->events.load(std::memory_order_relaxed) << "\n";
+            Family(out, "sim_queue_depth", "gauge", "Customers waiting for an account, sampled.");
+            for (size_t i = 0; i < simulations.size(); i++) {
+                for (size_t s = 0; s < simulations[i]->service_names.size(); s++)
+                    out << "sim_queue_depth{" << simulations[i]->label << ",service=\"" << simulations[i]->service_names[s] << "\"} "
+                        << simulations[i]->queue_depth[s].load(std::memory_order_relaxed) << "\n";
+            }
+            Family(out, "sim_active_sessions", "gauge", "Accounts in use, sampled.");
+            for (size_t i = 0; i < simulations.size(); i++) {
+                for (size_t s = 0; s < simulations[i]->service_names.size(); s++)
+                    out << "sim_active_sessions{" << simulations[i]->label << ",service=\"" << simulations[i]->service_names[s] << "\"} "
+                        << simulations[i]->active_sessions[s].load(std::memory_order_relaxed) << "\n";
+            }
+            return out.str();
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<PhaseCounters> threads;          // a deque never moves its elements
+        std::vector<SimulationGauges*> simulations;
+        std::vector<std::unique_ptr<SimulationGauges>> finished;   // the unregistered ones among them
+        int next_simulation = 0;                    // forks of one snapshot share a replication, so each gets an id
+
+        static void Family(std::ostream& out, const char* name, const char* type, const char* help) {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+        }
+
+        // measured once against the steady clock
+        static double CyclesPerSecond() {
+            static double rate = [] {
+                auto start = std::chrono::steady_clock::now();
+                uint64_t c0 = ReadCycles();
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                uint64_t c1 = ReadCycles();
+                return (c1 - c0) / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }();
+            return rate;
+        }
+};
+
+// adds the cycles from construction to destruction to the calling thread's counters
+class PhaseTimer {
+    public:
+        PhaseTimer(int phase) {
+            if (INSTRUMENTATION_ENABLED) {
+                this->phase = phase;
+                start = ReadCycles();
+            }
+        }
+        ~PhaseTimer() {
+            if (phase >= 0)
+                MetricsRegistry::Instance().ThreadCounters()->Add(phase, ReadCycles() - start);
+        }
+
+    private:
+        int phase = -1;
+        uint64_t start = 0;
+};
+
+#define INSTRUMENT_PHASE(phase) PhaseTimer instrument_phase_timer(phase)
+
+// background thread that writes the metrics every interval to a file and/or serves them on a Unix socket
+class MetricsReporter {
+    public:
+        // constructor, either path may be empty
+        MetricsReporter(const std::string& file_path, const std::string& socket_path, int interval_ms)
+            : file_path(file_path), socket_path(socket_path), interval_ms(std::max(10, interval_ms)) {
+            if (!socket_path.empty()) {
+                listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+                unlink(socket_path.c_str());
+                if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+                    if (listen_fd >= 0)
+                        close(listen_fd);
+                    listen_fd = -1;
+                }
+            }
+            reporter = std::thread([this] { ReportLoop(); });
+        }
+
+        // destructor, writes a last report
+        ~MetricsReporter() {
+            stopping.store(true, std::memory_order_release);
+            reporter.join();
+            WriteFile();
+            if (listen_fd >= 0) {
+                close(listen_fd);
+                unlink(socket_path.c_str());
+            }
+        }
+
+        bool SocketOpen() const {
+            return listen_fd >= 0;
+        }
+
+    private:
+        std::string file_path;
+        std::string socket_path;
+        int interval_ms;
+        int listen_fd = -1;
+        std::atomic<bool> stopping{false};
+        std::thread reporter;
+
+        // write to a temporary file and rename it, so readers never see half a report
+        void WriteFile() {
+            if (file_path.empty())
+                return;
+            std::string text = MetricsRegistry::Instance().Render();
+            std::string tmp = file_path + ".tmp";
+            FILE* file = fopen(tmp.c_str(), "w");
+            if (file == NULL)
+                return;
+            fwrite(text.data(), 1, text.size(), file);
+            fclose(file);
+            rename(tmp.c_str(), file_path.c_str());
+        }
+
+        void ReportLoop() {
+            auto next = std::chrono::steady_clock::now();
+            while (!stopping.load(std::memory_order_acquire)) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= next) {
+                    WriteFile();
+                    next = now + std::chrono::milliseconds(interval_ms);
+                }
+                int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+                wait_ms = std::max(1, std::min(wait_ms, 50));   // wake up often enough to notice stopping
+                if (listen_fd < 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+                    continue;
+                }
+                struct pollfd p = {listen_fd, POLLIN, 0};
+                if (poll(&p, 1, wait_ms) > 0) {
+                    int client = accept(listen_fd, NULL, NULL);
+                    if (client >= 0) {
+                        std::string text = MetricsRegistry::Instance().Render();
+                        // MSG_NOSIGNAL: a client that hung up (EPIPE, ECONNRESET) is dropped instead of
+                        // raising SIGPIPE, which would end the whole simulation
+                        for (size_t sent = 0; sent < text.size(); ) {
+                            ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                            if (n < 0 && errno == EINTR)
+                                continue;
+                            if (n <= 0)
+                                break;
+                            sent += n;
+                        }
+                        close(client);
+                    }
+                }
+            }
+        }
+};
+
+#else   // SIMULATION_INSTRUMENTATION
+
+class SimulationGauges;
+
+#define INSTRUMENT_PHASE(phase) ((void)0)
+
+#endif  // SIMULATION_INSTRUMENTATION
+
+#endif
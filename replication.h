@@ -0,0 +1,291 @@
+/****************************************************************************************
+    replication.h
+
+    Runs independent replications of the simulation on a thread pool and merges their
+    per-service metrics into means with 95% confidence intervals. Replication r draws
+    from its own counter-based random streams keyed by (seed, r), so the merged results
+    do not depend on how many threads ran them.
+
+    Variance reduction: runs with the same seed see the same draws for every customer's
+    k-th session (common random numbers), so Difference of two configurations' results
+    cancels the noise they share. Antithetic pairs average replications 2k and 2k+1, the
+    second of which uses the complement of every draw of the first. The queueing metrics
+    are not monotone in every draw, so the two halves can move together and pairing can
+    widen the intervals; PairingVarianceRatio measures it, and pairs are off by default.
+    Control variates
+    regress each metric on the replication's offered load, whose mean is known from the
+    service shares and the service time distribution.
+****************************************************************************************/
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "simulation.h"
+#include "thread_pool.h"
+#include "sharded_simulation.h"
+
+/*--------------------------------CONFIDENCE INTERVALS--------------------------------*/
+// sample mean and the half-width of its 95% confidence interval
+struct Estimate {
+    double mean = NAN;
+    double half_width = NAN;        // NAN when fewer than two samples were available
+    int n = 0;                      // number of samples the estimate is based on
+};
+
+// two-sided 95% Student-t critical value t(0.975, df)
+inline double TCritical95(int df) {
+    static const double table[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < 1)
+        return NAN;
+    if (df <= 30)
+        return table[df-1];
+    if (df <= 60)
+        return 2.000;
+    if (df <= 120)
+        return 1.980;
+    return 1.960;
+}
+
+// sample variance (n-1 denominator), 0 with fewer than two samples
+inline double Variance(const std::vector<double>& samples) {
+    if (samples.size() < 2)
+        return 0;
+    double sum = 0, sq = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    double mean = sum / samples.size();
+    for (size_t i = 0; i < samples.size(); i++)
+        sq += (samples[i] - mean) * (samples[i] - mean);
+    return sq / (samples.size() - 1);
+}
+
+// mean and 95% confidence interval of the samples, skipping undefined (nan) samples
+// such as the average delay of a service that never queued anyone
+inline Estimate MeanWithCI(const std::vector<double>& samples) {
+    std::vector<double> defined;
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (!std::isnan(samples[i]))
+            defined.push_back(samples[i]);
+    }
+    Estimate est;
+    est.n = defined.size();
+    if (est.n == 0)
+        return est;
+    double sum = 0;
+    for (int i = 0; i < est.n; i++)
+        sum += defined[i];
+    est.mean = sum / est.n;
+    if (est.n < 2)
+        return est;
+    est.half_width = TCritical95(est.n - 1) * std::sqrt(Variance(defined)) / std::sqrt((double)est.n);
+    return est;
+}
+
+// mean of the samples adjusted by a control with a known mean, y - beta*(x - control_mean) with beta
+// fitted by least squares over the same samples, and its 95% confidence interval (n-2 degrees of
+// freedom, as beta is estimated); falls back to MeanWithCI with fewer than three samples
+inline Estimate ControlledMeanWithCI(const std::vector<double>& samples, const std::vector<double>& controls, double control_mean) {
+    std::vector<double> y, x;
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (!std::isnan(samples[i]) && !std::isnan(controls[i])) {
+            y.push_back(samples[i]);
+            x.push_back(controls[i]);
+        }
+    }
+    int n = y.size();
+    if (n < 3)
+        return MeanWithCI(samples);
+    double y_mean = 0, x_mean = 0;
+    for (int i = 0; i < n; i++) {
+        y_mean += y[i] / n;
+        x_mean += x[i] / n;
+    }
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < n; i++) {
+        sxx += (x[i] - x_mean) * (x[i] - x_mean);
+        sxy += (x[i] - x_mean) * (y[i] - y_mean);
+    }
+    if (sxx <= 0)
+        return MeanWithCI(samples);
+    double beta = sxy / sxx;
+    double residual = 0;
+    for (int i = 0; i < n; i++) {
+        double e = y[i] - y_mean - beta * (x[i] - x_mean);
+        residual += e * e;
+    }
+    Estimate est;
+    est.n = n;
+    est.mean = y_mean - beta * (x_mean - control_mean);
+    double variance = residual / (n - 2) * (1.0 / n + (x_mean - control_mean) * (x_mean - control_mean) / sxx);
+    est.half_width = TCritical95(n - 2) * std::sqrt(variance);
+    return est;
+}
+/*------------------------------------------------------------------------------------*/
+
+
+/*--------------------------------REPLICATION RUNNER--------------------------------*/
+// merged queueing results for one streaming service
+struct ServiceSummary {
+    Estimate avg_cust_in_queue;
+    Estimate queue_util;
+    Estimate num_delays;
+    Estimate prob_delay;
+    Estimate service_prob_delay;
+    Estimate avg_delay;
+    Estimate max_delay;
+    Estimate wait_p50;
+    Estimate wait_p95;
+    Estimate wait_p99;
+    Estimate avg_queue_length;
+    Estimate avg_busy_accounts;
+    std::vector<long long> wait_histogram;      // bucket counts summed over the replications
+};
+
+struct ReplicationResults {
+    std::vector<std::vector<ServiceMetrics>> metrics;   // metrics[replication][service]
+    int arrival_of_last_customer = 0;                   // from replication 0
+    int sys_time = 0;                                   // simulated time at the end of each run
+    bool antithetic = false;                            // replications 2k and 2k+1 are an antithetic pair
+    bool control_variates = false;                      // estimate with the offered load as a control
+    // sharded runs only, over every replication: windows handled, rolled back and handled on one thread
+    long long num_windows = 0;
+    long long num_rollbacks = 0;
+    long long num_serial = 0;
+};
+
+// estimate of one metric of one service across all replications; the two halves of an antithetic
+// pair make one sample, and an unfinished pair is left out
+inline Estimate CombineMetric(const ReplicationResults& results, int service, double ServiceMetrics::*field) {
+    std::vector<double> samples, controls;
+    size_t step = results.antithetic ? 2 : 1;
+    for (size_t r = 0; r + step <= results.metrics.size(); r += step) {
+        double sample = 0, control = 0;
+        for (size_t k = r; k < r + step; k++) {
+            sample += results.metrics[k][service].*field;
+            control += results.metrics[k][service].offered_load;
+        }
+        samples.push_back(sample / step);
+        controls.push_back(control / step);
+    }
+    if (results.control_variates && !results.metrics.empty())
+        return ControlledMeanWithCI(samples, controls, results.metrics[0][service].expected_offered_load);
+    return MeanWithCI(samples);
+}
+
+// variance of the antithetic pair means over the variance the same replications would give as
+// independent samples, Var(pair mean) / (Var(replication) / 2): below 1 the pairing narrowed the
+// interval, above 1 it widened it. NAN with fewer than two whole pairs.
+inline double PairingVarianceRatio(const ReplicationResults& results, int service, double ServiceMetrics::*field) {
+    std::vector<double> singles, pairs;
+    for (size_t r = 0; r + 2 <= results.metrics.size(); r += 2) {
+        double a = results.metrics[r][service].*field;
+        double b = results.metrics[r+1][service].*field;
+        if (std::isnan(a) || std::isnan(b))
+            continue;
+        singles.push_back(a);
+        singles.push_back(b);
+        pairs.push_back((a + b) / 2);
+    }
+    if (pairs.size() < 2)
+        return NAN;
+    double single_var = Variance(singles), pair_var = Variance(pairs);
+    if (single_var <= 0)
+        return NAN;
+    return pair_var / (single_var / 2);
+}
+
+// every metric of 'alt' minus the same metric of 'base', replication by replication; with the same seed
+// both saw the same draws, so most of their noise cancels. The control stays base's offered load.
+inline ReplicationResults Difference(const ReplicationResults& base, const ReplicationResults& alt) {
+    static double ServiceMetrics::* const fields[] = {
+        &ServiceMetrics::avg_cust_in_queue, &ServiceMetrics::queue_util, &ServiceMetrics::num_delays, &ServiceMetrics::prob_delay,
+        &ServiceMetrics::service_prob_delay, &ServiceMetrics::avg_delay, &ServiceMetrics::max_delay, &ServiceMetrics::wait_p50, &ServiceMetrics::wait_p95,
+        &ServiceMetrics::wait_p99, &ServiceMetrics::avg_queue_length, &ServiceMetrics::avg_busy_accounts};
+    ReplicationResults diff = base;
+    for (size_t r = 0; r < diff.metrics.size() && r < alt.metrics.size(); r++) {
+        for (size_t i = 0; i < diff.metrics[r].size(); i++) {
+            ServiceMetrics& d = diff.metrics[r][i];
+            for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+                d.*fields[f] = alt.metrics[r][i].*fields[f] - base.metrics[r][i].*fields[f];
+            for (size_t k = 0; k < d.wait_histogram.size(); k++)
+                d.wait_histogram[k] = alt.metrics[r][i].wait_histogram[k] - base.metrics[r][i].wait_histogram[k];
+        }
+    }
+    diff.metrics.resize(std::min(base.metrics.size(), alt.metrics.size()));
+    return diff;
+}
+
+inline std::vector<ServiceSummary> Summarize(const ReplicationResults& results) {
+    int num_services = results.metrics.empty() ? 0 : (int)results.metrics[0].size();
+    std::vector<ServiceSummary> summary(num_services);
+    for (int i = 0; i < num_services; i++) {
+        summary[i].avg_cust_in_queue = CombineMetric(results, i, &ServiceMetrics::avg_cust_in_queue);
+        summary[i].queue_util = CombineMetric(results, i, &ServiceMetrics::queue_util);
+        summary[i].num_delays = CombineMetric(results, i, &ServiceMetrics::num_delays);
+        summary[i].prob_delay = CombineMetric(results, i, &ServiceMetrics::prob_delay);
+        summary[i].service_prob_delay = CombineMetric(results, i, &ServiceMetrics::service_prob_delay);
+        summary[i].avg_delay = CombineMetric(results, i, &ServiceMetrics::avg_delay);
+        summary[i].max_delay = CombineMetric(results, i, &ServiceMetrics::max_delay);
+        summary[i].wait_p50 = CombineMetric(results, i, &ServiceMetrics::wait_p50);
+        summary[i].wait_p95 = CombineMetric(results, i, &ServiceMetrics::wait_p95);
+        summary[i].wait_p99 = CombineMetric(results, i, &ServiceMetrics::wait_p99);
+        summary[i].avg_queue_length = CombineMetric(results, i, &ServiceMetrics::avg_queue_length);
+        summary[i].avg_busy_accounts = CombineMetric(results, i, &ServiceMetrics::avg_busy_accounts);
+        summary[i].wait_histogram.assign(LogHistogram::num_buckets, 0);
+        for (size_t r = 0; r < results.metrics.size(); r++) {
+            for (int k = 0; k < LogHistogram::num_buckets; k++)
+                summary[i].wait_histogram[k] += results.metrics[r][i].wait_histogram[k];
+        }
+    }
+    return summary;
+}
+
+// run num_replications replications on the pool; only replication 0 writes transaction data and
+// rollups. With num_shards > 1 the replications run one after another, each sharded over the pool.
+inline ReplicationResults RunReplications(unsigned long long seed, int num_replications, const SimulationConfig& config, ThreadPool& pool,
+                                          TransactionLogWriter* transactions = NULL, int num_shards = 1, RollupWriter* rollups = NULL) {
+    ReplicationResults results;
+    results.metrics.resize(num_replications);
+    results.antithetic = config.antithetic;
+    results.control_variates = config.control_variates;
+    if (num_shards > 1) {
+        for (int r = 0; r < num_replications; r++) {
+            ShardedSimulation sharded(seed, r, config, num_shards, r == 0 ? transactions : NULL);
+            if (r == 0 && rollups != NULL)
+                sharded.sim.SetRollups(rollups);
+            sharded.Run(pool);
+            results.metrics[r] = sharded.sim.Metrics();
+            results.num_windows += sharded.num_windows;
+            results.num_rollbacks += sharded.num_rollbacks;
+            results.num_serial += sharded.num_serial;
+            if (r == 0) {
+                results.arrival_of_last_customer = sharded.sim.arrival_of_last_customer;
+                results.sys_time = sharded.sim.sys_time;
+            }
+        }
+        return results;
+    }
+    for (int r = 0; r < num_replications; r++) {
+        pool.Submit([&results, &config, seed, r, transactions, rollups] {
+            Simulation sim(seed, r, config, r == 0 ? transactions : NULL);
+            if (r == 0 && rollups != NULL)
+                sim.SetRollups(rollups);
+            sim.Run();
+            results.metrics[r] = sim.Metrics();
+            if (r == 0) {
+                results.arrival_of_last_customer = sim.arrival_of_last_customer;
+                results.sys_time = sim.sys_time;
+            }
+        });
+    }
+    pool.Wait();
+    return results;
+}
+/*----------------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,207 @@
+/****************************************************************************************
+    rollups.h
+
+    Windowed rollups for long horizons. Every StreamingService keeps the totals of its
+    current simulated day and of each of the 24 hours of the day (arrivals, customers
+    queued, delays, queue time, busy accounts). A finished day is handed to RollupWriter,
+    which appends it to a small csv right away, so memory and output grow with the number
+    of days at most, and the hour-of-day table stays 24 rows per service for any horizon.
+
+    Hours and days are those of the simulated clock (minute t is hour t % 1440 / 60 of day
+    t / 1440). A wait is counted in the window the customer leaves the queue in.
+****************************************************************************************/
+
+#ifndef ROLLUPS_H
+#define ROLLUPS_H
+
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+const int rollup_day = 60*24;           // minutes per day window
+const int rollup_hour = 60;             // minutes per hour-of-day window
+const int rollup_hours = 24;
+
+// one service's totals over one window of simulated time
+struct RollupWindow {
+    long long arrivals = 0;             // customers that came for the service
+    long long queued = 0;               // of those, customers that found every account busy
+    long long delays = 0;               // customers that left the queue after waiting a minute or more
+    long long total_wait = 0;           // minutes waited by those
+    int max_wait = 0;
+    double busy_area = 0;               // account-minutes in use
+    int peak_busy = 0;                  // most accounts in use at once
+    int minutes = 0;                    // minutes of the run the window covers
+
+    double AvgWait() const {
+        return delays > 0 ? (double)total_wait / delays : NAN;
+    }
+    double AvgBusy() const {
+        return minutes > 0 ? busy_area / minutes : NAN;
+    }
+};
+
+// a service's current day and hour-of-day windows; only the thread handling the service touches it
+class ServiceRollup {
+    public:
+        bool enabled = false;
+        RollupWindow hours[rollup_hours];               // every day's hour h added together
+        std::vector<RollupWindow> finished;             // days ended since the writer last took them, oldest first
+        int first_unwritten_day = 0;                    // day of finished[0]
+
+        // start keeping windows at 'time' with 'busy' accounts in use
+        void Start(int time, int busy) {
+            enabled = true;
+            first_unwritten_day = time / rollup_day;
+            last_time = time;
+            this->busy = busy;
+            today.peak_busy = busy;
+        }
+
+        // add the accounts in use up to 'time' to the windows, ending every day before it
+        void AdvanceTo(int time) {
+            while (last_time < time) {
+                int next = std::min(time, (last_time / rollup_hour + 1) * rollup_hour);
+                RollupWindow& hour = hours[last_time % rollup_day / rollup_hour];
+                hour.busy_area += (double)busy * (next - last_time);
+                hour.minutes += next - last_time;
+                hour.peak_busy = std::max(hour.peak_busy, busy);
+                today.busy_area += (double)busy * (next - last_time);
+                today.minutes += next - last_time;
+                last_time = next;
+                if (last_time % rollup_day == 0) {
+                    finished.push_back(today);
+                    today = RollupWindow();
+                    today.peak_busy = busy;
+                }
+            }
+        }
+
+        void Arrival(int time, bool queued) {
+            AdvanceTo(time);
+            RollupWindow& hour = Hour(time);
+            hour.arrivals++;
+            today.arrivals++;
+            if (queued) {
+                hour.queued++;
+                today.queued++;
+            }
+        }
+
+        void Wait(int time, int wait) {
+            AdvanceTo(time);
+            if (wait <= 0)
+                return;
+            RollupWindow& hour = Hour(time);
+            hour.delays++;
+            hour.total_wait += wait;
+            hour.max_wait = std::max(hour.max_wait, wait);
+            today.delays++;
+            today.total_wait += wait;
+            today.max_wait = std::max(today.max_wait, wait);
+        }
+
+        void Busy(int time, int busy) {
+            AdvanceTo(time);
+            this->busy = busy;
+            Hour(time).peak_busy = std::max(Hour(time).peak_busy, busy);
+            today.peak_busy = std::max(today.peak_busy, busy);
+        }
+
+        // the day in progress, ended early at the end of the run
+        void FinishDay() {
+            if (today.minutes > 0)
+                finished.push_back(today);
+            today = RollupWindow();
+        }
+
+    private:
+        RollupWindow today;
+        int last_time = 0;                              // busy accounts are added up to here
+        int busy = 0;                                   // accounts in use since last_time
+
+        RollupWindow& Hour(int time) {
+            return hours[time % rollup_day / rollup_hour];
+        }
+};
+
+// appends every service's finished days to the daily csv as they come, and writes the hour-of-day csv at the end
+class RollupWriter {
+    public:
+        std::vector<std::vector<RollupWindow>> hours;   // hours[service][h], filled in by Finish
+
+        // constructor, opens the daily file
+        RollupWriter(const std::string& daily_path, const std::string& hourly_path, const std::vector<std::string>& names)
+            : hourly_path(hourly_path), names(names) {
+            daily = fopen(daily_path.c_str(), "w");
+            if (daily != NULL)
+                fprintf(daily, "Day, Service Name, Arrivals, Queued, Delays, Average Queue Time, Maximum Queue Time, Average Busy Accounts, Peak Busy Accounts\n");
+        }
+
+        // destructor
+        ~RollupWriter() {
+            if (daily != NULL)
+                fclose(daily);
+        }
+
+        RollupWriter(const RollupWriter&) = delete;
+        RollupWriter& operator=(const RollupWriter&) = delete;
+
+        bool IsOpen() const {
+            return daily != NULL;
+        }
+
+        // write the days every service has finished, oldest first
+        void Drain(const std::vector<ServiceRollup*>& services) {
+            size_t days = services.empty() ? 0 : services[0]->finished.size();
+            for (size_t i = 1; i < services.size(); i++)
+                days = std::min(days, services[i]->finished.size());
+            for (size_t d = 0; d < days; d++) {
+                for (size_t i = 0; i < services.size(); i++) {
+                    const RollupWindow& w = services[i]->finished[d];
+                    fprintf(daily, "%d, %s, %lld, %lld, %lld, %.4f, %d, %.4f, %d\n", services[i]->first_unwritten_day + (int)d, names[i].c_str(),
+                            w.arrivals, w.queued, w.delays, w.AvgWait(), w.max_wait, w.AvgBusy(), w.peak_busy);
+                }
+            }
+            for (size_t i = 0; i < services.size(); i++) {
+                services[i]->finished.erase(services[i]->finished.begin(), services[i]->finished.begin() + days);
+                services[i]->first_unwritten_day += days;
+            }
+        }
+
+        // write the last (partial) day and the hour-of-day file once the run is over at end_time
+        void Finish(const std::vector<ServiceRollup*>& services, int end_time) {
+            for (size_t i = 0; i < services.size(); i++) {
+                services[i]->AdvanceTo(end_time);
+                services[i]->FinishDay();
+            }
+            Drain(services);
+            fflush(daily);
+
+            hours.assign(services.size(), std::vector<RollupWindow>());
+            FILE* file = fopen(hourly_path.c_str(), "w");
+            if (file != NULL)
+                fprintf(file, "Hour, Service Name, Arrivals Per Day, Queued Per Day, Delays Per Day, Average Queue Time, Maximum Queue Time, Average Busy Accounts, Peak Busy Accounts\n");
+            for (int h = 0; h < rollup_hours; h++) {
+                for (size_t i = 0; i < services.size(); i++) {
+                    const RollupWindow& w = services[i]->hours[h];
+                    hours[i].push_back(w);
+                    double days = w.minutes / (double)rollup_hour;       // how many times the run went through this hour
+                    if (file != NULL)
+                        fprintf(file, "%d, %s, %.2f, %.2f, %.2f, %.4f, %d, %.4f, %d\n", h, names[i].c_str(), w.arrivals / days, w.queued / days,
+                                w.delays / days, w.AvgWait(), w.max_wait, w.AvgBusy(), w.peak_busy);
+                }
+            }
+            if (file != NULL)
+                fclose(file);
+        }
+
+    private:
+        FILE* daily;
+        std::string hourly_path;
+        std::vector<std::string> names;
+};
+
+#endif
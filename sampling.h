@@ -0,0 +1,149 @@
+/****************************************************************************************
+    sampling.h
+
+    Random sampling building blocks. Philox4x32-10 is a counter-based generator: a block
+    of four 32-bit words is a pure function of a 128-bit counter and a 64-bit key, so any
+    draw can be recomputed on its own, in any order and on any thread, without carrying
+    generator state around. AliasTable samples a discrete distribution in O(1) from a
+    single 32-bit word (Walker's alias method, built with Vose's algorithm).
+****************************************************************************************/
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <stdint.h>
+#include <vector>
+
+/*--------------------------------PHILOX4x32-10--------------------------------*/
+// Salmon et al., "Parallel random numbers: as easy as 1, 2, 3" (SC 2011)
+const uint32_t philox_m0 = 0xD2511F53;
+const uint32_t philox_m1 = 0xCD9E8D57;
+const uint32_t philox_w0 = 0x9E3779B9;
+const uint32_t philox_w1 = 0xBB67AE85;
+
+// the block of four words for one counter
+inline void Philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t x0 = counter[0], x1 = counter[1], x2 = counter[2], x3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)philox_m0 * x0;
+        uint64_t p1 = (uint64_t)philox_m1 * x2;
+        uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1 ^ k0;
+        uint32_t y1 = (uint32_t)p1;
+        uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3 ^ k1;
+        uint32_t y3 = (uint32_t)p0;
+        x0 = y0; x1 = y1; x2 = y2; x3 = y3;
+        k0 += philox_w0;
+        k1 += philox_w1;
+    }
+    out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+}
+
+// blocks for the counters (first + i, c1, c2, c3), i < count, written to out[4*i .. 4*i+3];
+// the rounds run over lanes of independent counters so the compiler can vectorize them
+inline void Philox4x32Fill(uint32_t first, uint32_t c1, uint32_t c2, uint32_t c3, const uint32_t key[2], size_t count, uint32_t* out) {
+    const size_t lanes = 64;
+    uint32_t x0[lanes], x1[lanes], x2[lanes], x3[lanes];
+    for (size_t base = 0; base < count; base += lanes) {
+        size_t n = count - base < lanes ? count - base : lanes;
+        for (size_t j = 0; j < lanes; j++) {
+            x0[j] = first + (uint32_t)(base + j);
+            x1[j] = c1;
+            x2[j] = c2;
+            x3[j] = c3;
+        }
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; round++) {
+            for (size_t j = 0; j < lanes; j++) {
+                uint64_t p0 = (uint64_t)philox_m0 * x0[j];
+                uint64_t p1 = (uint64_t)philox_m1 * x2[j];
+                uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1[j] ^ k0;
+                uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3[j] ^ k1;
+                x1[j] = (uint32_t)p1;
+                x3[j] = (uint32_t)p0;
+                x0[j] = y0;
+                x2[j] = y2;
+            }
+            k0 += philox_w0;
+            k1 += philox_w1;
+        }
+        for (size_t j = 0; j < n; j++) {
+            out[4*(base + j) + 0] = x0[j];
+            out[4*(base + j) + 1] = x1[j];
+            out[4*(base + j) + 2] = x2[j];
+            out[4*(base + j) + 3] = x3[j];
+        }
+    }
+}
+
+// uniform double in (0, 1) from one word
+inline double ToUniform(uint32_t word) {
+    return ((double)word + 0.5) * (1.0 / 4294967296.0);
+}
+
+// uniform int in [0, n) from one word (multiply-shift, no division)
+inline int ToBelow(uint32_t word, int n) {
+    return (int)(((uint64_t)word * (uint32_t)n) >> 32);
+}
+/*-----------------------------------------------------------------------------*/
+
+
+/*--------------------------------ALIAS TABLE--------------------------------*/
+// O(1) sampling of index i with probability weights[i] / sum(weights)
+class AliasTable {
+    public:
+        AliasTable() {}
+
+        // constructor, weights need not be normalized but must not all be zero
+        AliasTable(const std::vector<double>& weights) {
+            int n = weights.size();
+            threshold.assign(n, 0);
+            alias.resize(n);
+            double total = 0;
+            for (int i = 0; i < n; i++)
+                total += weights[i];
+            std::vector<double> scaled(n);
+            std::vector<int> small, large;
+            for (int i = 0; i < n; i++) {
+                scaled[i] = weights[i] * n / total;
+                alias[i] = i;
+                (scaled[i] < 1 ? small : large).push_back(i);
+            }
+            while (!small.empty() && !large.empty()) {
+                int s = small.back(); small.pop_back();
+                int l = large.back(); large.pop_back();
+                threshold[s] = ToThreshold(scaled[s]);
+                alias[s] = l;
+                scaled[l] -= 1 - scaled[s];
+                (scaled[l] < 1 ? small : large).push_back(l);
+            }
+            // whatever is left is full up to rounding and keeps its own index
+            for (size_t i = 0; i < small.size(); i++)
+                alias[small[i]] = small[i];
+            for (size_t i = 0; i < large.size(); i++)
+                alias[large[i]] = large[i];
+        }
+
+        int Size() const {
+            return (int)alias.size();
+        }
+
+        // the high bits of word * n pick a column, the low bits flip its biased coin
+        int Sample(uint32_t word) const {
+            uint64_t scaled = (uint64_t)word * alias.size();
+            int column = (int)(scaled >> 32);
+            return (uint32_t)scaled < threshold[column] ? column : alias[column];
+        }
+
+    private:
+        std::vector<uint32_t> threshold;        // keep the column when the coin is below this (scaled to 2^32)
+        std::vector<int> alias;                 // index to use otherwise
+
+        static uint32_t ToThreshold(double p) {
+            double t = p * 4294967296.0;
+            return t >= 4294967295.0 ? 4294967295u : (uint32_t)t;
+        }
+};
+/*---------------------------------------------------------------------------*/
+
+#endif
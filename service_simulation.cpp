@@ -5,9 +5,34 @@
     Instructions:
     1) Create a folder in your current working directory named "output_files" 
     2) Use the following line in your terminal to compile the program:
-        g++-12 -o service_simulation.out service_simulation.cpp
+        g++-12 -std=c++17 -O2 -pthread -o service_simulation.out service_simulation.cpp
     3) Run the program using the following line:
         ./service_simulation.cpp
+       Add "--seed N" to reproduce a run exactly, "--replications N" to run N independent
+       replications (95% confidence intervals are added to servicedata.csv) and "--threads N"
+       to limit how many run at once (default: every core). "--shards N" instead spreads each
+       replication's services over N threads (same results as one thread).
+       Add "--optimize" to search for the cheapest account counts that meet a delay target
+       (see "--target-prob-delay", "--target-max-delay", "--min-replications" and "--max-replications").
+       Transactions are logged to output_files/transactions.bin; "--export-transactions" renders
+       that file as output_files/transactions.csv.
+       Add "--save-snapshot FILE" to save the state once every customer has arrived, and
+       "--from-snapshot FILE" to resume it, optionally with other "--accounts N,N,..." or "--months N";
+       each "--scenario N,N,..." instead forks one more account vector from it, all run at once.
+       Add "--metrics-file FILE" to have the run's progress, per-phase timings and queue gauges
+       rewritten there every "--metrics-interval MS" (default 1000) in the Prometheus text format,
+       or "--metrics-socket PATH" to serve them to whoever connects to that Unix socket.
+       Add "--compare-accounts N,N,..." to run the configured and the given accounts on the same
+       random numbers and report their paired differences; "--antithetic" runs replications in
+       antithetic pairs (off by default: it can widen the intervals, and the run reports whether
+       it helped) and "--control-variates" adjusts the estimates by the known offered load.
+       Add "--surrogate" to print the analytical model's predictions next to the simulated
+       results (and, with "--optimize", to bracket the search with them); "--predict" prints
+       only the predictions, without simulating.
+       Add "--rollups" for long horizons: the first replication's arrivals, waits and busy accounts
+       are totalled per simulated day (output_files/rollup_daily.csv) and per hour of the day
+       (output_files/rollup_hourly.csv), and the transaction log is skipped unless
+       "--keep-transactions" is given too.
     - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
     - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
@@ -27,361 +52,637 @@
 #include <iostream>
 #include <stdlib.h>
 #include <string>
-#include <random>
-#include <queue>
 #include <cmath>
 #include <ctime>
 #include <iomanip>
-#include <algorithm>
 #include <fstream>
+#include <cstring>
+#include <memory>
+#include "simulation.h"
+#include "replication.h"
+#include "capacity_search.h"
+#include "thread_pool.h"
+#include "transaction_log.h"
+#include "snapshot.h"
+#include "surrogate_model.h"
+
+// print a value followed by its 95% confidence interval half-width
+void PrintWithCI(std::ostream& out, int width, const Estimate& est) {
+    out << std::setw(width) << est.mean << " +/- " << std::setw(8) << est.half_width;
+}
 
-/*--------------------------GLOBAL CONSTANTS--------------------------*/
-const double our_monthly_fee = 20;         // price customer pays for our service
-const double mean_service_time = 150;      // mean service time in minutes 
-const int num_customers = 10000;           // number of customers in total
-const int num_services = 6;                // number of streaming services
-const int month_min = 60*24*31;            // one month of simulation in minutes
-const int num_months = 2;                  // number of months to run the simulation
-bool VIEW_LIVE_TRANSACTIONS = false;       // set to 'true' if you want to view the live transactions in the terminal
-/*-------------------------CONST GLOBAL ARRAYS------------------------*/
-const std::string service_names[num_services] = {"Netflix", "Disney+", "CraveTv", "Prime", "Paramount+", "AppleTv+"};
-const double service_costs[num_services] = {9.99, 11.99, 9.99, 9.99, 9.99, 8.99};
-const int service_accounts[num_services] = {300, 200, 200, 200, 50, 50};
-/*--------------------------GLOBAL VARIABLES--------------------------*/
-int num_interactions = 0;
-/*--------------------------------------------------------------------*/
-
-
-/*--------------------------------RANDOM NUMBER GENERATORS--------------------------------*/
-std::default_random_engine generator;
-std::exponential_distribution<double> service_dist(1 / mean_service_time);
-/*----------------------------------------------------------------------------------------*/
-
-
-/*-------------------------------CUSTOMER CLASS-------------------------------*/
-class Customer {
-    public:
-        int cust_id;
-        int arrival_time;    
-        int service_time;
-        int depart_time = -1;
-        int time_of_queue;
-        int delay_time;
-        int chosen_service;
-
-        // constructor
-        Customer(int cust_id, int arrival_time) {
-            this->cust_id = cust_id;
-            this->arrival_time = arrival_time;
-        }
+// print the cost & revenue block and write it to costdata.csv
+void ReportCostAndRevenue(const CostRevenue& money) {
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << "\n---  COST & REVENUE RESULTS  ---\n";
+    std::cout << "\nCost: $" << money.total_cost;
+    std::cout << "\nRevenue: $" << money.revenue;
+    std::cout << "\nProfit: $" << money.profit << "\n";
 
-        void SetServiceTime() {
-            //service_time = round(service_dist(generator) + 1);
+    // write the cost data to a csv file
+    std::ofstream monetaryfile;
+    monetaryfile.open ("output_files/costdata.csv");
+    // write the data field names
+    monetaryfile << "Total Cost, Revenue, Profit\n";
+    monetaryfile << money.total_cost << ", " << money.revenue << ", " << money.profit << "\n";
+}
 
-            // test --> uniform distribution between 0.5 and 3 hours (30 minutes - 180 minutes)
-            double u = (double)rand() / (double)RAND_MAX;
-            service_time = 30 + (u * 150);
-        }
+// warm up the first replication until the last customer has arrived and save its state
+int SaveWarmSnapshot(const SimulationConfig& config, unsigned long long seed, const std::string& path) {
+    Simulation sim(seed, 0, config);
+    sim.RunUntil(sim.arrival_of_last_customer);
+    if (!SaveSnapshot(sim, path)) {
+        std::cerr << "could not write " << path << "\n";
+        return 1;
+    }
+    std::cout << "Saved the state at " << StreamingService::GetDateTime(sim.sys_time) << " (seed " << seed << ", "
+              << config.num_customers << " customers, " << sim.events.heap.size() << " pending events) to " << path << "\n";
+    return 0;
+}
 
-        void SetArrivalTime(int sys_time, int offset = 0) {
-            int time;
-            int time_of_day = sys_time % 60*24;
-            double u = (double)rand() / (double)RAND_MAX;
-            if (time_of_day < 60*12) {  // if customer leaves service before 12pm, then
-                if (u < 0.1) {         // 10% probability that the customer arrives at a uniformly distibuted time between time_of_day + 12 hours and 1pm
-                    time = (sys_time - time_of_day) + rand()%((60*13)-(time_of_day)+1) + (time_of_day);
-                }
-                else if (u < 0.6) {    // 50% probability that the customer arrives at a uniformly distibuted time between 1pm-9pm
-                    time = (sys_time - time_of_day) + rand()%((60*21)-(60*13)+1) + (60*13);
-                }
-                else {                  // 40% probability that the customer arrives at a uniformly distibuted time between 9pm-1am
-                    time = (sys_time - time_of_day) + rand()%((60*25)-(60*21)+1) + (60*21);
-                }
-            }
-            else {                      // if customer leaves service after 12pm, then
-                if (u < 0.4) {          // 40% probability that the customer arrives at a uniformly distibuted time between time_of_day and 1am
-                    time = (sys_time - time_of_day) + rand()%((60*25)-(time_of_day)+1) + (time_of_day);
-                }
-                else if (u < 0.5) {     // 10% probability that the customer arrives at a uniformly distibuted time between 1am and 9am
-                    time = (sys_time - time_of_day) + 60*24 + rand()%((60*9)-(60)+1) + (60);
-                }
-                else {                  // 50% probability that the customer arrives at a uniformly distibuted time between 9am and 1pm
-                    time = (sys_time - time_of_day) + 60*24 + rand()%((60*13)-(60*9)+1) + (60*9);
-                }
-            }
-            arrival_time = time + offset;
-        }
+// parse a comma-separated list of account counts, one per service
+bool ParseAccounts(const char* text, std::vector<int>& accounts) {
+    accounts.clear();
+    for (const char* p = text; *p != '\0'; ) {
+        char* end;
+        long count = strtol(p, &end, 10);
+        if (end == p || count < 0)
+            return false;
+        accounts.push_back((int)count);
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return false;
+    }
+    return !accounts.empty();
+}
 
-        void ChooseService() {
-            double u = (double)rand() / (double)RAND_MAX;
-            if (u < 0.3) {          // 30% probability that the customer choses Netflix
-                chosen_service = 0;
-            }
-            else if (u < 0.5) {     // 20% probability that the customer choses Disney+
-                chosen_service = 1;
-            }
-            else if (u < 0.7) {     // 20% probability that the customer choses CraveTv
-                chosen_service = 2;
-            }
-            else if (u < 0.9) {     // 20% probability that the customer choses Prime
-                chosen_service = 3;
-            }
-            else if (u < 0.95) {    // 5% probability that the customer choses Paramount+
-                chosen_service = 4;
-            }
-            else {                  // 5% probability that the customer choses AppleTv+
-                chosen_service = 5;
-            }
+// print the surrogate model's predictions for the configured accounts, next to the simulated
+// results when there are some, and write them to surrogate.csv
+void ReportSurrogate(const SimulationConfig& config, const std::vector<ServiceSummary>* simulated) {
+    SurrogateModel model(config);
+    std::vector<SurrogatePrediction> predictions = model.Predict(config.accounts);
+    std::cout << "\n---  SURROGATE MODEL PREDICTIONS" << (simulated != NULL ? " VS SIMULATED" : "") << "  ---\n";
+    std::cout << "\n   Service    Num_Accounts    Offered_Load    Utilization    Svc_Prob_of_Queue    Sim_Svc_Prob_of_Queue    Avg_Queue(mins)    Sim_Avg_Queue(mins)\n";
+    std::cout << "---------------------------------------------------------------------------------------------------------------------------------------------\n";
+    std::cout << std::setprecision(4) << std::fixed;
+    std::ofstream surrogatefile;
+    surrogatefile.open ("output_files/surrogate.csv");
+    surrogatefile << "Service Name, Number Of Accounts, Offered Load, Utilization, Service Probability Of Queue, Simulated Service Probability Of Queue, Average Queue Time, Simulated Average Queue Time\n";
+    for (int i = 0; i < config.NumServices(); i++) {
+        const SurrogatePrediction& p = predictions[i];
+        double sim_prob = simulated != NULL ? (*simulated)[i].service_prob_delay.mean : NAN;
+        double sim_delay = simulated != NULL ? (*simulated)[i].avg_delay.mean : NAN;
+        std::cout << "  " << std::setw(10) << config.services[i].name
+            << "    " << std::setw(12) << config.accounts[i]
+            << "    " << std::setw(12) << p.offered_load
+            << "    " << std::setw(11) << p.utilization
+            << "    " << std::setw(17) << p.prob_delay
+            << "    " << std::setw(21) << sim_prob
+            << "    " << std::setw(15) << p.avg_delay
+            << "    " << std::setw(19) << sim_delay << "\n";
+        surrogatefile << config.services[i].name << ", " << config.accounts[i] << ", " << p.offered_load << ", " << p.utilization << ", "
+                      << p.prob_delay << ", " << sim_prob << ", " << p.avg_delay << ", " << sim_delay << "\n";
+    }
+}
+
+// print every service's busiest hour of the day (most accounts in use on average) from the rollups
+void ReportPeakHours(const SimulationConfig& config, const RollupWriter& rollups, bool first_replication_only) {
+    std::cout << "\n---  PEAK HOUR OF DAY" << (first_replication_only ? " (FIRST REPLICATION)" : "") << "  ---\n";
+    std::cout << "\n   Service    Num_Accounts    Peak_Hour    Arrivals_Per_Day    Prob_of_Queue    Avg_Queue(mins)    Max_Queue(mins)    Avg_Busy    Peak_Busy\n";
+    std::cout << "-----------------------------------------------------------------------------------------------------------------------------------------\n";
+    std::cout << std::setprecision(4) << std::fixed;
+    for (int i = 0; i < config.NumServices() && i < (int)rollups.hours.size(); i++) {
+        const std::vector<RollupWindow>& hours = rollups.hours[i];
+        int peak = 0;
+        for (int h = 1; h < (int)hours.size(); h++) {
+            if (hours[h].AvgBusy() > hours[peak].AvgBusy())
+                peak = h;
         }
+        const RollupWindow& w = hours[peak];
+        double days = w.minutes / (double)rollup_hour;
+        std::cout << "  " << std::setw(10) << config.services[i].name
+            << "    " << std::setw(12) << config.accounts[i]
+            << "    " << std::setw(6) << StreamingService::StringTime(peak) << ":00"
+            << "    " << std::setw(16) << (days > 0 ? w.arrivals / days : NAN)
+            << "    " << std::setw(13) << (w.arrivals > 0 ? (double)w.queued / w.arrivals : NAN)
+            << "    " << std::setw(15) << w.AvgWait()
+            << "    " << std::setw(15) << w.max_wait
+            << "    " << std::setw(8) << w.AvgBusy()
+            << "    " << std::setw(9) << w.peak_busy << "\n";
+    }
+}
+
+// comparison mode: the configured and the alternative accounts on common random numbers, reporting
+// the paired differences of the main metrics with their 95% confidence intervals
+int RunComparison(const SimulationConfig& config, const std::vector<int>& alt_accounts, unsigned long long seed, int num_replications, int num_threads) {
+    SimulationConfig alt = config;
+    alt.accounts = alt_accounts;
+    ThreadPool pool(std::min(num_threads > 0 ? num_threads : ThreadPool::DefaultThreads(), num_replications));
+    ReplicationResults base_results = RunReplications(seed, num_replications, config, pool);
+    ReplicationResults alt_results = RunReplications(seed, num_replications, alt, pool);
+    std::vector<ServiceSummary> base = Summarize(base_results);
+    std::vector<ServiceSummary> diff = Summarize(Difference(base_results, alt_results));
+
+    std::cout << "\033[0mSeed: " << seed << ", replications: " << num_replications
+              << (config.antithetic ? " (antithetic pairs)" : "") << (config.control_variates ? ", control variates" : "") << "\n";
+    std::cout << "\n---  PAIRED DIFFERENCES, ALTERNATIVE - CONFIGURED (COMMON RANDOM NUMBERS)  ---\n";
+    std::cout << "\n   Service    Accounts    Alt_Accounts         Prob_of_Queue_Diff           Avg_Queue_Diff(mins)           Max_Queue_Diff(mins)\n";
+    std::cout << "-----------------------------------------------------------------------------------------------------------------------------\n";
+    std::cout << std::setprecision(4) << std::fixed;
+    for (int i = 0; i < config.NumServices(); i++) {
+        std::cout << "  " << std::setw(10) << config.services[i].name
+            << "    " << std::setw(8) << config.accounts[i] << "    " << std::setw(12) << alt.accounts[i] << "    ";
+        PrintWithCI(std::cout, 10, diff[i].prob_delay);
+        std::cout << "    ";
+        PrintWithCI(std::cout, 12, diff[i].avg_delay);
+        std::cout << "    ";
+        PrintWithCI(std::cout, 12, diff[i].max_delay);
+        std::cout << "\n";
+    }
+
+    // write the differences to a csv file, next to the configured accounts' own estimates
+    std::ofstream comparefile;
+    comparefile.open ("output_files/comparison.csv");
+    comparefile << "Service Name, Number Of Accounts, Alternative Number Of Accounts, Replications, "
+                << "Probability Of Queue, Probability Of Queue Difference, Probability Of Queue Difference CI95, "
+                << "Average Queue Time, Average Queue Time Difference, Average Queue Time Difference CI95, "
+                << "Maximum Queue Time, Maximum Queue Time Difference, Maximum Queue Time Difference CI95\n";
+    for (int i = 0; i < config.NumServices(); i++) {
+        comparefile << config.services[i].name << ", " << config.accounts[i] << ", " << alt.accounts[i] << ", " << num_replications << ", "
+                    << base[i].prob_delay.mean << ", " << diff[i].prob_delay.mean << ", " << diff[i].prob_delay.half_width << ", "
+                    << base[i].avg_delay.mean << ", " << diff[i].avg_delay.mean << ", " << diff[i].avg_delay.half_width << ", "
+                    << base[i].max_delay.mean << ", " << diff[i].max_delay.mean << ", " << diff[i].max_delay.half_width << "\n";
+    }
+    return 0;
+}
 
-        void ReInitializeCustomer(int sys_time) {
-            ChooseService();
-            SetArrivalTime(sys_time);
-            SetServiceTime();
+// fork every scenario (an account vector) from the snapshot, all on the pool, and report each
+// service's results per scenario; they share the snapshot's warm-up and random numbers
+int RunScenarios(const SimulationSnapshot& snapshot, const SimulationConfig& base, const std::vector<std::vector<int>>& scenarios, int num_threads) {
+    std::vector<SimulationConfig> configs(scenarios.size(), base);
+    for (size_t k = 0; k < scenarios.size(); k++)
+        configs[k].accounts = scenarios[k];
+    ThreadPool pool(std::min(num_threads > 0 ? num_threads : ThreadPool::DefaultThreads(), (int)scenarios.size()));
+    std::vector<ReplicationResults> results = ForkScenarios(snapshot, configs, pool);
+
+    std::cout << "\033[0mSeed: " << snapshot.Header().seed << ", " << scenarios.size() << " scenarios forked at "
+              << StreamingService::GetDateTime(snapshot.Header().sys_time) << "\n";
+    std::cout << "\n---  SCENARIO RESULTS  ---\n";
+    std::cout << "\n   Scenario       Cost       Service    Num_Accounts    Svc_Prob_of_Queue    Avg_Queue(mins)    Max_Queue(mins)\n";
+    std::cout << "---------------------------------------------------------------------------------------------------------------\n";
+    std::ofstream scenariofile;
+    scenariofile.open ("output_files/scenarios.csv");
+    scenariofile << "Scenario, Total Cost, Service Name, Number Of Accounts, Service Probability Of Queue, Average Queue Time, Maximum Queue Time\n";
+    bool all_ok = true;
+    for (size_t k = 0; k < configs.size(); k++) {
+        if (results[k].metrics.empty()) {
+            std::cerr << "scenario " << k + 1 << " could not be forked from the snapshot\n";
+            all_ok = false;
+            continue;
         }
-};
-/*---------------------------------------------------------------------------*/
-
-
-/*------------------------------------STREAMING SERVICE CLASS------------------------------------*/
-class StreamingService {
-    public:
-        int num_accounts;                             // number of accounts for the service
-        double cost;                                  // monthly cost for the streaming service
-        std::string name;                             // streaming service name
-        // queue delay variables
-        int num_delays = 0;
-        int total_delay = 0;
-        int max_delay = 0;
-        int time_in_queue = 0;
-        int num_active_users = 0;                     // number of active users (initially zero)
-        std::queue<Customer*> service_queue;          // queue for users
-        Customer* active_users[num_customers];        // array of active users
-        
-        // function to convert time in int to string with leading zeros
-        std::string StringTime(int arg) {
-            size_t n = 2;   // date and clock time use 2 digits always (leading zeros)
-            return std::string(n - std::min(n, std::to_string(arg).length()), '0') + std::to_string(arg);
+        double cost = ComputeCostRevenue(configs[k]).total_cost;
+        for (int i = 0; i < configs[k].NumServices(); i++) {
+            const ServiceMetrics& m = results[k].metrics[0][i];
+            std::cout << std::setprecision(2) << std::fixed
+                << "  " << std::setw(9) << k + 1
+                << "    $" << std::setw(9) << cost
+                << "    " << std::setw(10) << configs[k].services[i].name
+                << "    " << std::setw(12) << configs[k].accounts[i]
+                << std::setprecision(4)
+                << "    " << std::setw(17) << m.service_prob_delay
+                << "    " << std::setw(15) << m.avg_delay
+                << std::setprecision(0)
+                << "    " << std::setw(15) << m.max_delay << "\n";
+            scenariofile << k + 1 << ", " << cost << ", " << configs[k].services[i].name << ", " << configs[k].accounts[i] << ", "
+                         << m.service_prob_delay << ", " << m.avg_delay << ", " << m.max_delay << "\n";
         }
+    }
+    return all_ok ? 0 : 1;
+}
 
-        // constructor
-        StreamingService(const int num_accounts, const double cost, const std::string name) {
-            this->num_accounts = num_accounts;
-            this->cost = cost;
-            this->name = name;
-            for (int i = 0; i < num_customers; i++) {
-                active_users[i] = NULL;
-            }
-        }
+// optimizer mode: find the cheapest account count per service that meets the target
+int RunCapacitySearch(const SimulationConfig& base, unsigned long long seed, const ServiceLevelTarget& target, int num_threads, int min_replications, int max_replications,
+                      bool use_surrogate) {
+    ThreadPool pool(num_threads);
+    SurrogateModel surrogate(base);
+    std::cout << "\033[0mSearching for the cheapest accounts with Svc_Prob_of_Queue < " << target.max_prob_delay
+              << " and Max_Queue < " << target.max_delay << " mins (seed " << seed << ", "
+              << min_replications << "-" << max_replications << " replications per candidate)\n\n";
+    CapacitySearchResult result = SearchCapacity(base, seed, target, pool, min_replications, max_replications, std::cout, use_surrogate ? &surrogate : NULL);
+
+    std::cout << "\n" << result.num_evaluations << " candidate account vectors, " << result.num_replications << " replications\n";
+    std::cout << "\n---  CAPACITY SEARCH RESULTS (" << result.final_check.replications << " REPLICATIONS)  ---\n";
+    std::cout << "\n   Service    Num_Accounts          Svc_Prob_of_Queue              Max_Queue(mins)    Meets_Target\n";
+    std::cout << "----------------------------------------------------------------------------------------------------\n";
+    std::cout << std::setprecision(4) << std::fixed;
+    for (int i = 0; i < base.NumServices(); i++) {
+        const ServiceSummary& s = result.final_check.summary[i];
+        std::cout << "  " << std::setw(10) << base.services[i].name
+            << "    " << std::setw(10) << result.config.accounts[i] << "    ";
+        PrintWithCI(std::cout, 10, s.service_prob_delay);
+        std::cout << "    ";
+        PrintWithCI(std::cout, 10, s.max_delay);
+        std::cout << "    " << std::setw(10) << (ServiceVerdict(s, target, true) == PASSES ? "yes" : "no") << "\n";
+    }
 
-        // function to serve customers, or add them to queue if the service is full
-        void ServeCustomer(Customer* cust, int sys_time) {
-            if (num_active_users < num_accounts) {                  // if the service is available, then
-                num_active_users++;                                 // increment the number of active users
-                active_users[cust->cust_id] = cust;                 // add user to the active users array
-                cust->depart_time = sys_time + cust->service_time;  // calculate the departure time
-                num_interactions++;                                 // increase the number of interactions
-                if (VIEW_LIVE_TRANSACTIONS == true)
-                    std::cout << "\033[1;32mCustomer " << cust->cust_id << " entered service " << name << " at time " << GetDateTime(sys_time) << " and will leave at time " << GetDateTime(cust->depart_time) << "\n";
-            }
-            else {
-                service_queue.push(cust);                           // add customer to queue
-                cust->time_of_queue = sys_time;                     // set the time of queue for the customer
-                if (VIEW_LIVE_TRANSACTIONS == true)
-                    std::cout << "\033[1;33mCustomer " << cust->cust_id << " entered queue for service " << name << " at time " << GetDateTime(sys_time) << "\n";
-            }
-        }
+    CostRevenue money = ComputeCostRevenue(result.config);
+    ReportCostAndRevenue(money);
+    std::cout << "Break-even monthly fee: $" << money.break_even_fee << "\n";
+
+    // write the chosen accounts to a csv file
+    std::ofstream searchfile;
+    searchfile.open ("output_files/capacitysearch.csv");
+    searchfile << "Service Name, Number Of Accounts, Service Probability Of Queue, Service Probability Of Queue CI95, Maximum Queue Time, Maximum Queue Time CI95, Meets Target\n";
+    for (int i = 0; i < base.NumServices(); i++) {
+        const ServiceSummary& s = result.final_check.summary[i];
+        searchfile << base.services[i].name << ", " << result.config.accounts[i] << ", "
+                   << s.service_prob_delay.mean << ", " << s.service_prob_delay.half_width << ", "
+                   << s.max_delay.mean << ", " << s.max_delay.half_width << ", "
+                   << (ServiceVerdict(s, target, true) == PASSES ? "yes" : "no") << "\n";
+    }
+    if (!result.confirmed) {
+        std::cerr << "warning: the chosen accounts of the services marked \"no\" missed the target in the "
+                  << result.final_check.replications << "-replication check; raise --max-replications\n";
+        return 1;
+    }
+    return 0;
+}
 
-        // function to release customers that are ready to be released, and serve queued customers when a customer leaves
-        void ReleaseCustomer(Customer* cust, int sys_time) {
-            active_users[cust->cust_id] = NULL;                         // remove the user from active users array
-            num_active_users--;                                         // decrease the active users count
-            if (VIEW_LIVE_TRANSACTIONS == true)
-                std::cout << "\033[1;31mCustomer " << cust->cust_id << " left service " << name << " at time " << GetDateTime(sys_time) << "\n";
-            if (service_queue.size() > 0) {                             // if there is queued customers, then
-                Customer *q_cust = service_queue.front();              // get the customer at the front of queue
-                service_queue.pop();                                    // remove that customer from the queue
-                q_cust->delay_time = sys_time - q_cust->time_of_queue;  // calculate the delay time for the customer
-                total_delay += (sys_time - q_cust->time_of_queue);      // increase the total delay time for this service queue
-                if (sys_time != q_cust->time_of_queue)                  // if customer spent time in queue, then
-                    num_delays++;                                       // increment the number of delays for this service
-                if (q_cust->delay_time > max_delay)                     // if customer delay is largest delay, then
-                    max_delay = q_cust->delay_time;                     // set the maximum delay to customer delay
-                q_cust->ReInitializeCustomer(sys_time);                 // reinitialize the customer (choose service, get service time)
-                active_users[q_cust->cust_id] = q_cust;                 // add user to the active users array
-                if (service_queue.size() > 0)                           // if the queue is not empty, then
-                    time_in_queue++;                                    // increment the time in queue
-                if (VIEW_LIVE_TRANSACTIONS == true)
-                    std::cout << "\033[1;34mCustomer " << q_cust->cust_id << " left queue for service " << name << " at time " << GetDateTime(sys_time) << "\n";
-            }
+int main(int argc, char* argv[]) {
+    unsigned long long seed = time(NULL);
+    int num_replications = 1;
+    int num_threads = 0;                // 0 uses every core
+    int num_shards = 1;                 // threads one replication is spread over
+    bool optimize = false;
+    bool export_transactions = false;
+    ServiceLevelTarget target;
+    int min_replications = 3;
+    int max_replications = 10;
+    SimulationConfig config;
+    std::vector<int> accounts;          // --accounts override, empty to keep the configured counts
+    std::vector<int> compare_accounts;  // --compare-accounts alternative, empty unless comparing
+    std::vector<std::vector<int>> scenarios;    // --scenario account vectors to fork from the snapshot
+    std::vector<int> scenario_accounts;
+    bool antithetic = false;
+    bool control_variates = false;
+    bool use_surrogate = false;
+    bool predict_only = false;
+    bool months_set = false;
+    bool use_rollups = false;
+    bool keep_transactions = false;
+    std::string save_snapshot;
+    std::string from_snapshot;
+    std::string metrics_file;
+    std::string metrics_socket;
+    int metrics_interval = 1000;        // milliseconds between metrics files
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--replications") == 0 && i + 1 < argc)
+            num_replications = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+            num_shards = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--customers") == 0 && i + 1 < argc)
+            config.num_customers = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--months") == 0 && i + 1 < argc) {
+            config.num_months = std::max(1, atoi(argv[++i]));
+            months_set = true;
         }
-
-        // function to get the time as month-day hours:minutes
-        std::string GetDateTime(int time) {
-            int months = (int)((float)time / (float)month_min);
-            int days = (int)((float)(time - months*month_min) / (float)(24*60));
-            int hours = (int)((float)(time - months*month_min - days*24*60) / (float)(60));
-            int minutes = time - months*month_min - days*24*60 - hours*60;
-            size_t n = 2;   // clock time uses 2 digits always (leading zeros)
-            return StringTime(months+1) + "/" + StringTime(days+1) + "/2023" + " " + StringTime(hours) + ":" + StringTime(minutes);
+        else if (strcmp(argv[i], "--accounts") == 0 && i + 1 < argc && ParseAccounts(argv[i+1], accounts))
+            i++;
+        else if (strcmp(argv[i], "--compare-accounts") == 0 && i + 1 < argc && ParseAccounts(argv[i+1], compare_accounts))
+            i++;
+        else if (strcmp(argv[i], "--antithetic") == 0)
+            antithetic = true;
+        else if (strcmp(argv[i], "--control-variates") == 0)
+            control_variates = true;
+        else if (strcmp(argv[i], "--surrogate") == 0)
+            use_surrogate = true;
+        else if (strcmp(argv[i], "--predict") == 0)
+            predict_only = true;
+        else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc)
+            save_snapshot = argv[++i];
+        else if (strcmp(argv[i], "--from-snapshot") == 0 && i + 1 < argc)
+            from_snapshot = argv[++i];
+        else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc && ParseAccounts(argv[i+1], scenario_accounts)) {
+            scenarios.push_back(scenario_accounts);
+            i++;
         }
-        std::string GetTime(int time) {
-            int hours = (int)((float)time / (float)60);
-            int minutes = time - hours*60;
-            return StringTime(hours) + ":" + StringTime(minutes);
+        else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc)
+            metrics_file = argv[++i];
+        else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc)
+            metrics_socket = argv[++i];
+        else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc)
+            metrics_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rollups") == 0)
+            use_rollups = true;
+        else if (strcmp(argv[i], "--keep-transactions") == 0)
+            keep_transactions = true;
+        else if (strcmp(argv[i], "--export-transactions") == 0)
+            export_transactions = true;
+        else if (strcmp(argv[i], "--optimize") == 0)
+            optimize = true;
+        else if (strcmp(argv[i], "--target-prob-delay") == 0 && i + 1 < argc)
+            target.max_prob_delay = atof(argv[++i]);
+        else if (strcmp(argv[i], "--target-max-delay") == 0 && i + 1 < argc)
+            target.max_delay = atof(argv[++i]);
+        else if (strcmp(argv[i], "--min-replications") == 0 && i + 1 < argc)
+            min_replications = std::max(2, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--max-replications") == 0 && i + 1 < argc)
+            max_replications = std::max(2, atoi(argv[++i]));
+        else {
+            std::cerr << "usage: " << argv[0] << " [--seed N] [--replications N] [--threads N] [--shards N] [--customers N] [--months N] [--accounts N,N,...]\n"
+                      << "       " << argv[0] << " --save-snapshot FILE [--seed N] [--customers N] [--accounts N,N,...]\n"
+                      << "       " << argv[0] << " --from-snapshot FILE [--months N] [--accounts N,N,... | --scenario N,N,... [--scenario N,N,...] ...]\n"
+                      << "       " << argv[0] << " --compare-accounts N,N,... [--replications N] [--accounts N,N,...] [--seed N] [--threads N]\n"
+                      << "       " << argv[0] << " --predict [--customers N] [--months N] [--accounts N,N,...]\n"
+                      << "       " << argv[0] << " --optimize [--target-prob-delay P] [--target-max-delay MINS]\n"
+                      << "              [--min-replications N] [--max-replications N] [--seed N] [--threads N] [--surrogate]\n"
+                      << "       " << argv[0] << " --export-transactions\n"
+                      << "       replications can be estimated with [--antithetic] [--control-variates], and compared with [--surrogate]\n"
+                      << "       any run also takes [--metrics-file FILE] [--metrics-socket PATH] [--metrics-interval MS]\n"
+                      << "       and [--rollups [--keep-transactions]]\n";
+            return 1;
         }
+    }
 
-        // function for probability of delay
-        double ProbDelay() {
-            return (double)num_delays / (double)num_interactions;
+    // render the binary transaction log of the last run as csv
+    if (export_transactions) {
+        if (!ExportTransactionsCsv("output_files/transactions.bin", "output_files/transactions.csv")) {
+            std::cerr << "could not export output_files/transactions.bin\n";
+            return 1;
         }
-        // function for average delay time
-        double AvgDelay() {
-            return (double)total_delay / (double)num_delays;
+        return 0;
+    }
+
+    // start the metrics reporter before any simulation is created, so every one registers its gauges
+#if SIMULATION_INSTRUMENTATION
+    std::unique_ptr<MetricsReporter> reporter;
+    if (!metrics_file.empty() || !metrics_socket.empty()) {
+        INSTRUMENTATION_ENABLED = true;
+        reporter.reset(new MetricsReporter(metrics_file, metrics_socket, metrics_interval));
+        if (!metrics_socket.empty() && !reporter->SocketOpen())
+            std::cerr << "could not listen on " << metrics_socket << "\n";
+    }
+#else
+    (void)metrics_interval;
+    if (!metrics_file.empty() || !metrics_socket.empty())
+        std::cerr << "built without instrumentation (SIMULATION_INSTRUMENTATION=0), no metrics are written\n";
+#endif
+
+    // a fork resumes the snapshot's customers, seed and catalog; only the accounts and horizon change
+    std::unique_ptr<SimulationSnapshot> snapshot;
+    if (!from_snapshot.empty()) {
+        snapshot.reset(new SimulationSnapshot(from_snapshot));
+        if (!snapshot->IsOpen()) {
+            std::cerr << "could not read snapshot " << from_snapshot << "\n";
+            return 1;
         }
-        // function for queue utilization
-        double QueueUtil(int sys_time) {
-            return (double)time_in_queue * 100 / (double)sys_time;
+        int num_months = config.num_months;
+        config = snapshot->Config();
+        if (months_set)
+            config.num_months = num_months;
+        seed = snapshot->Header().seed;
+        num_replications = 1;
+    }
+    if (!accounts.empty()) {
+        if ((int)accounts.size() != config.NumServices()) {
+            std::cerr << "--accounts needs " << config.NumServices() << " counts, one per service\n";
+            return 1;
         }
-};
-/*-----------------------------------------------------------------------------------------------*/
-
-double LittlesLaw(int sys_time, int num_delays, double avg_delay) {
-    double lambda = (double)num_delays / (double)sys_time;
-    return lambda * avg_delay;
+        config.accounts = accounts;
+    }
+    if (!snapshot) {
+        config.antithetic = antithetic;
+        config.control_variates = control_variates;
+        if (antithetic)
+            num_replications += num_replications % 2;      // whole pairs only
+    }
 
-}
+    if (!compare_accounts.empty()) {
+        if ((int)compare_accounts.size() != config.NumServices()) {
+            std::cerr << "--compare-accounts needs " << config.NumServices() << " counts, one per service\n";
+            return 1;
+        }
+        return RunComparison(config, compare_accounts, seed, std::max(2, num_replications), num_threads);
+    }
 
-int main() {
-    srand(time(NULL));
-    /*---------------------------INITIALIZE STREAMING SERVICES---------------------------*/
-    StreamingService* services[num_services];                    // array of the streaming services
-    for (int i=0; i < num_services; i++) {
-        StreamingService* s_serv;
-        s_serv = new StreamingService(service_accounts[i], service_costs[i], service_names[i]);
-        services[i] = s_serv;      // fill array with streaming services
+    if (!scenarios.empty()) {
+        if (!snapshot) {
+            std::cerr << "--scenario forks from a snapshot, add --from-snapshot FILE\n";
+            return 1;
+        }
+        for (size_t k = 0; k < scenarios.size(); k++) {
+            if ((int)scenarios[k].size() != config.NumServices()) {
+                std::cerr << "--scenario needs " << config.NumServices() << " counts, one per service\n";
+                return 1;
+            }
+        }
+        return RunScenarios(*snapshot, config, scenarios, num_threads);
     }
 
-    /*-------------------------------INITIALIZE CUSTOMERS--------------------------------*/
-    int arrival_of_last_customer = 0;
-    Customer* customers[num_customers];                    // array of customers
-    for (int i=0; i < num_customers; i++) {
-        Customer* cust;
-        cust = new Customer(i, 0);
-        cust->ChooseService();
-        cust->SetArrivalTime(0, i);
-        cust->SetServiceTime();
-        customers[i] = cust;      // fill array with customers
-
-        // if the customer is the last one to enter service, record their time of arrival
-        if (cust->arrival_time > arrival_of_last_customer)
-            arrival_of_last_customer = cust->arrival_time;
+    if (predict_only) {
+        ReportSurrogate(config, NULL);
+        return 0;
     }
 
-    /*-------------------------RUN CUSTOMERS THROUGH SIMULATION--------------------------*/
-    int sys_time = 0;                    // simulated time
+    if (!save_snapshot.empty())
+        return SaveWarmSnapshot(config, seed, save_snapshot);
 
-    // open csv file for transactions
-    std::ofstream outfile;
-    outfile.open ("output_files/transactions.csv");
-    // write the data field names
-    outfile << "Customer Id, Service Name, Time Of Arrival, Time Of Departure, Minutes In Service, Minutes In Queue\n";
+    if (optimize)
+        return RunCapacitySearch(config, seed, target, num_threads, min_replications, std::max(min_replications, max_replications), use_surrogate);
 
-    while (sys_time < num_months*month_min) {
-        /* serve new customers */
-        for (int i=0; i<num_customers; i++) {
-            if (customers[i]->arrival_time == sys_time) {
-                services[customers[i]->chosen_service]->ServeCustomer(customers[i], sys_time);
-            }
-            if (customers[i]->depart_time == sys_time) {
-                services[customers[i]->chosen_service]->ReleaseCustomer(customers[i], sys_time);
-
-                // after all customers have entered the system at least once
-                if (sys_time >= arrival_of_last_customer) {
-                    // write transaction data to csv file 
-                    outfile << customers[i]->cust_id << ", ";
-                    outfile << services[customers[i]->chosen_service]->name << ", ";
-                    outfile << services[0]->GetDateTime(customers[i]->arrival_time) << ", ";
-                    outfile << services[0]->GetDateTime(customers[i]->depart_time) << ", ";
-                    outfile << customers[i]->service_time << ", ";
-                    outfile << customers[i]->delay_time << "\n";
-                }
-
-                customers[i]->ReInitializeCustomer(sys_time);
-            }
+    /*-------------------------RUN CUSTOMERS THROUGH SIMULATION--------------------------*/
+    // open the binary transaction log (written by the first replication); with rollups only if asked for
+    std::unique_ptr<TransactionLogWriter> transactions;
+    if (!use_rollups || keep_transactions)
+        transactions.reset(new TransactionLogWriter("output_files/transactions.bin", config.ServiceNames(), month_min));
+    TransactionLogWriter* log = transactions && transactions->IsOpen() ? transactions.get() : NULL;
+    std::unique_ptr<RollupWriter> rollups;
+    if (use_rollups) {
+        rollups.reset(new RollupWriter("output_files/rollup_daily.csv", "output_files/rollup_hourly.csv", config.ServiceNames()));
+        if (!rollups->IsOpen()) {
+            std::cerr << "could not write output_files/rollup_daily.csv\n";
+            return 1;
+        }
+    }
+
+    ReplicationResults results;
+    if (snapshot) {
+        Simulation* sim = ForkSimulation(*snapshot, config, log, rollups.get());
+        snapshot.reset();
+        if (sim == NULL) {
+            std::cerr << "snapshot " << from_snapshot << " is truncated or corrupt\n";
+            return 1;
         }
-        sys_time++;
+        results.metrics.push_back(sim->Metrics());
+        results.arrival_of_last_customer = sim->arrival_of_last_customer;
+        results.sys_time = sim->sys_time;
+        delete sim;
+    }
+    else {
+        ThreadPool pool(num_shards > 1 ? num_shards : std::min(num_threads > 0 ? num_threads : ThreadPool::DefaultThreads(), num_replications));
+        results = RunReplications(seed, num_replications, config, pool, log, num_shards, rollups.get());
     }
-    // close the csv file
-    outfile.close();
+    std::vector<ServiceSummary> summary = Summarize(results);
+
+    // flush and close the transaction log
+    if (transactions)
+        transactions->Close();
 
 
     /* ---------------------- OUTPUT STATS ---------------------- */
 
-    std::cout << "\n\033[0mThe last customer entered the system at: " << services[0]->GetDateTime(arrival_of_last_customer) << "\n";
+    std::cout << "\n\033[0mSeed: " << seed << ", replications: " << num_replications
+              << (config.antithetic ? " (antithetic pairs)" : "") << (config.control_variates ? ", control variates" : "") << "\n";
+    std::cout << "The last customer entered the system at: " << StreamingService::GetDateTime(results.arrival_of_last_customer) << "\n";
+    if (results.num_windows > 0)
+        std::cout << "Sharded windows: " << results.num_windows << ", rolled back: " << results.num_rollbacks
+                  << ", handled on one thread: " << results.num_serial << "\n";
 
     /* --------------- COST & REVENUE --------------- */
     
-    double total_cost = 0;
-    for (int i = 0; i < num_services; i++)
-    {
-        total_cost += service_costs[i] * service_accounts[i] * num_months;
-    }
-    double revenue = (double)num_customers * our_monthly_fee * num_months;
-    double profit = revenue - total_cost;
-
-    std::cout << std::setprecision(2) << std::fixed;
-    std::cout << "\n---  COST & REVENUE RESULTS  ---\n";
-    std::cout << "\nCost: $" << total_cost;
-    std::cout << "\nRevenue: $" << revenue;
-    std::cout << "\nProfit: $" << profit << "\n";
+    ReportCostAndRevenue(ComputeCostRevenue(config));
 
     /* ------------------- QUEING & DELAY ------------------- */
 
     /* table for service outputs */         // use fstream write to a table in a file
-    std::cout << "\n---  SERVICE QUEUEING RESULTS  ---\n";
+    std::cout << "\n---  SERVICE QUEUEING RESULTS" << (num_replications > 1 ? " (MEAN OF REPLICATIONS)" : "") << "  ---\n";
     std::cout << "\n   Service      Cost       Num_Accounts    Avg_Cust_in_Queue   Queue_Util   Num_Queues   Prob_of_Queue   Avg_Queue(mins)   Max_Queue(mins)\n";
     std::cout << "-------------------------------------------------------------------------------------------------------------------------------------------\n";
-    for (int i = 0; i < num_services; i++) {
-        std::cout << "  " << std::setw(10) << services[i]->name
+    for (int i = 0; i < config.NumServices(); i++) {
+        std::cout << "  " << std::setw(10) << config.services[i].name
             << std::setprecision(2) << std::fixed
-            << "    " << std::setw(3) << "$" << services[i]->cost
-            << "    " << std::setw(8) << services[i]->num_accounts
+            << "    " << std::setw(3) << "$" << config.services[i].cost
+            << "    " << std::setw(8) << config.accounts[i]
             << std::setprecision(4) << std::fixed
-            << "    " << std::setw(13) << LittlesLaw(sys_time, services[i]->num_delays, services[i]->AvgDelay())
-            << "    " << std::setw(12) << services[i]->QueueUtil(sys_time) << "%"
-            << "    " << std::setw(9) << services[i]->num_delays
-            << "    " << std::setw(9) << services[i]->ProbDelay()
-            << "    " << std::setw(12) << services[i]->AvgDelay()
-            << "    " << std::setw(12) << services[i]->max_delay
+            << "    " << std::setw(13) << summary[i].avg_cust_in_queue.mean
+            << "    " << std::setw(12) << summary[i].queue_util.mean << "%"
+            << std::setprecision(num_replications > 1 ? 1 : 0)
+            << "    " << std::setw(9) << summary[i].num_delays.mean
+            << std::setprecision(4)
+            << "    " << std::setw(9) << summary[i].prob_delay.mean
+            << "    " << std::setw(12) << summary[i].avg_delay.mean
+            << std::setprecision(num_replications > 1 ? 1 : 0)
+            << "    " << std::setw(12) << summary[i].max_delay.mean
             << "\n";
     }
 
-    // write the cost data to a csv file
-    std::ofstream monetaryfile;
-    monetaryfile.open ("output_files/costdata.csv");
-    // write the data field names
-    monetaryfile << "Total Cost, Revenue, Profit\n";
-    monetaryfile << total_cost << ", " << revenue << ", " << profit << "\n";
+    if (num_replications > 1) {
+        std::cout << "\n---  95% CONFIDENCE INTERVALS OVER " << num_replications << " REPLICATIONS  ---\n";
+        std::cout << "\n   Service              Prob_of_Queue              Avg_Queue(mins)              Max_Queue(mins)\n";
+        std::cout << "------------------------------------------------------------------------------------------------\n";
+        std::cout << std::setprecision(4) << std::fixed;
+        for (int i = 0; i < config.NumServices(); i++) {
+            std::cout << "  " << std::setw(10) << config.services[i].name << "    ";
+            PrintWithCI(std::cout, 10, summary[i].prob_delay);
+            std::cout << "    ";
+            PrintWithCI(std::cout, 10, summary[i].avg_delay);
+            std::cout << "    ";
+            PrintWithCI(std::cout, 10, summary[i].max_delay);
+            std::cout << "\n";
+        }
+    }
+
+    // pairing does not always help these metrics, so show whether it did in this run
+    if (config.antithetic && num_replications >= 4) {
+        std::cout << "\n---  ANTITHETIC PAIRING: VARIANCE OF PAIR MEANS / VARIANCE AS INDEPENDENT REPLICATIONS (BELOW 1 HELPS)  ---\n";
+        std::cout << "\n   Service    Prob_of_Queue    Avg_Queue(mins)    Max_Queue(mins)\n";
+        std::cout << "-------------------------------------------------------------------\n";
+        std::cout << std::setprecision(2) << std::fixed;
+        for (int i = 0; i < config.NumServices(); i++) {
+            std::cout << "  " << std::setw(10) << config.services[i].name
+                << "    " << std::setw(13) << PairingVarianceRatio(results, i, &ServiceMetrics::prob_delay)
+                << "    " << std::setw(15) << PairingVarianceRatio(results, i, &ServiceMetrics::avg_delay)
+                << "    " << std::setw(15) << PairingVarianceRatio(results, i, &ServiceMetrics::max_delay)
+                << "\n";
+        }
+    }
+
+    /* ------------------- SURROGATE MODEL ------------------- */
+
+    if (use_surrogate)
+        ReportSurrogate(config, &summary);
+
+    /* ------------------- PEAK HOUR OF DAY ------------------- */
+
+    if (rollups)
+        ReportPeakHours(config, *rollups, num_replications > 1);
 
+    /* ------------------- WAIT DISTRIBUTION ------------------- */
 
-    // write the service data to a csv file
+    std::cout << "\n---  WAIT DISTRIBUTION & TIME AVERAGES" << (num_replications > 1 ? " (MEAN OF REPLICATIONS)" : "") << "  ---\n";
+    std::cout << "\n   Service    P50_Wait(mins)    P95_Wait(mins)    P99_Wait(mins)    Avg_Queue_Length    Avg_Busy_Accounts\n";
+    std::cout << "-------------------------------------------------------------------------------------------------------\n";
+    std::cout << std::setprecision(4) << std::fixed;
+    for (int i = 0; i < config.NumServices(); i++) {
+        std::cout << "  " << std::setw(10) << config.services[i].name
+            << "    " << std::setw(14) << summary[i].wait_p50.mean
+            << "    " << std::setw(14) << summary[i].wait_p95.mean
+            << "    " << std::setw(14) << summary[i].wait_p99.mean
+            << "    " << std::setw(16) << summary[i].avg_queue_length.mean
+            << "    " << std::setw(17) << summary[i].avg_busy_accounts.mean
+            << "\n";
+    }
+
+    // write the service data to a csv file; each value is the mean over the replications,
+    // followed by the half-widths of their 95% confidence intervals (nan for a single replication)
     std::ofstream servicefile;
     servicefile.open ("output_files/servicedata.csv");
     // write the data field names
-    servicefile << "Service Name, Service Cost, Number Of Accounts, Average Queue Contents, Queue Utilization, Instances Of Queue, Probability Of Queue, Average Queue Time, Maximum Queue Time\n";
-
-    for (int i = 0; i < num_services; i++) {
-        servicefile << services[i]->name << ", ";
-        servicefile << services[i]->cost << ", ";
-        servicefile << services[i]->num_accounts << ", ";
-        servicefile << LittlesLaw(sys_time, services[i]->num_delays, services[i]->AvgDelay()) << ", ";
-        servicefile << services[i]->QueueUtil(sys_time) << ", ";
-        servicefile << services[i]->num_delays << ", ";
-        servicefile << services[i]->ProbDelay() << ", ";
-        servicefile << services[i]->AvgDelay() << ", ";
-        servicefile << services[i]->max_delay << "\n";
+    servicefile << "Service Name, Service Cost, Number Of Accounts, Average Queue Contents, Queue Utilization, Instances Of Queue, Probability Of Queue, Average Queue Time, Maximum Queue Time, "
+                << "Replications, Average Queue Contents CI95, Queue Utilization CI95, Instances Of Queue CI95, Probability Of Queue CI95, Average Queue Time CI95, Maximum Queue Time CI95, "
+                << "P50 Wait Time, P95 Wait Time, P99 Wait Time, Time-Average Queue Length, Time-Average Busy Accounts, "
+                << "P50 Wait Time CI95, P95 Wait Time CI95, P99 Wait Time CI95, Time-Average Queue Length CI95, Time-Average Busy Accounts CI95\n";
+
+    for (int i = 0; i < config.NumServices(); i++) {
+        servicefile << config.services[i].name << ", ";
+        servicefile << config.services[i].cost << ", ";
+        servicefile << config.accounts[i] << ", ";
+        servicefile << summary[i].avg_cust_in_queue.mean << ", ";
+        servicefile << summary[i].queue_util.mean << ", ";
+        servicefile << summary[i].num_delays.mean << ", ";
+        servicefile << summary[i].prob_delay.mean << ", ";
+        servicefile << summary[i].avg_delay.mean << ", ";
+        servicefile << summary[i].max_delay.mean << ", ";
+        servicefile << num_replications << ", ";
+        servicefile << summary[i].avg_cust_in_queue.half_width << ", ";
+        servicefile << summary[i].queue_util.half_width << ", ";
+        servicefile << summary[i].num_delays.half_width << ", ";
+        servicefile << summary[i].prob_delay.half_width << ", ";
+        servicefile << summary[i].avg_delay.half_width << ", ";
+        servicefile << summary[i].max_delay.half_width << ", ";
+        servicefile << summary[i].wait_p50.mean << ", ";
+        servicefile << summary[i].wait_p95.mean << ", ";
+        servicefile << summary[i].wait_p99.mean << ", ";
+        servicefile << summary[i].avg_queue_length.mean << ", ";
+        servicefile << summary[i].avg_busy_accounts.mean << ", ";
+        servicefile << summary[i].wait_p50.half_width << ", ";
+        servicefile << summary[i].wait_p95.half_width << ", ";
+        servicefile << summary[i].wait_p99.half_width << ", ";
+        servicefile << summary[i].avg_queue_length.half_width << ", ";
+        servicefile << summary[i].avg_busy_accounts.half_width << "\n";
+    }
+
+    // write the wait histograms (summed over the replications) to a csv file, one row per bucket
+    std::ofstream histogramfile;
+    histogramfile.open ("output_files/waithistogram.csv");
+    histogramfile << "Minimum Wait, Maximum Wait";
+    for (int i = 0; i < config.NumServices(); i++)
+        histogramfile << ", " << config.services[i].name;
+    histogramfile << "\n";
+    for (int k = 0; k < LogHistogram::num_buckets; k++) {
+        histogramfile << LogHistogram::BucketLow(k) << ", ";
+        if (k == LogHistogram::num_buckets - 1)
+            histogramfile << "inf";
+        else
+            histogramfile << LogHistogram::BucketLow(k+1) - 1;
+        for (int i = 0; i < config.NumServices(); i++)
+            histogramfile << ", " << summary[i].wait_histogram[k];
+        histogramfile << "\n";
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,527 @@
+/****************************************************************************************
+    sharded_simulation.h
+
+    One replication spread over several threads. The services are split into shards, each
+    with its own event list, and simulated time advances in windows that every shard
+    handles at once. A served customer's next session is drawn when it enters service,
+    so the arrivals one shard creates for another are at least min_service_time ahead and
+    never fall inside the window they were created in; they wait in per-destination
+    mailboxes that each shard owns during the window and its destination drains after it.
+
+    The one exception is a customer leaving a queue, whose next arrival can come at any
+    later minute. Before each window every shard does a dry run of it that follows only
+    each service's busy accounts and queue, and the window is cut short before the first
+    arrival a queue leaver sends another shard; if that is in the window's first minute,
+    the window is handled on one thread with a single merged event list. Should an
+    arrival still land inside the window at another shard, the window is rolled back:
+    each service's counters are restored from a copy taken at the start of the window,
+    its queue, active sessions and wait histogram are undone change by change, and
+    customer writes are undone. Everything before that arrival was handled correctly,
+    so the window is retried ending there. Either way every service sees its events in
+    the sequential engine's order, so the results match Simulation::Run exactly.
+****************************************************************************************/
+
+#ifndef SHARDED_SIMULATION_H
+#define SHARDED_SIMULATION_H
+
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "simulation.h"
+#include "thread_pool.h"
+#include "transaction_log.h"
+
+// every field of one customer, saved before a window writes it so the window can be undone
+struct CustomerRow {
+    int cust_id;
+    int arrival_time;
+    int service_time;
+    int depart_time;
+    int time_of_queue;
+    int delay_time;
+    uint32_t session;
+    unsigned char chosen_service;
+
+    static CustomerRow Read(const CustomerTable& customers, int cust_id) {
+        return {cust_id, customers.arrival_time[cust_id], customers.service_time[cust_id], customers.depart_time[cust_id],
+                customers.time_of_queue[cust_id], customers.delay_time[cust_id], customers.session[cust_id], customers.chosen_service[cust_id]};
+    }
+    void Write(CustomerTable& customers) const {
+        customers.arrival_time[cust_id] = arrival_time;
+        customers.service_time[cust_id] = service_time;
+        customers.depart_time[cust_id] = depart_time;
+        customers.time_of_queue[cust_id] = time_of_queue;
+        customers.delay_time[cust_id] = delay_time;
+        customers.session[cust_id] = session;
+        customers.chosen_service[cust_id] = chosen_service;
+    }
+};
+
+// a service's counters and statistics, saved at the start of a window so the window can be undone;
+// its queue, active sessions and wait histogram are undone change by change instead of being copied
+struct ServiceCounters {
+    long long num_delays;
+    long long num_served;
+    long long num_arrivals;
+    long long num_queued;
+    long long offered_minutes;
+    long long total_delay;
+    int max_delay;
+    long long time_in_queue;
+    int num_active_users;
+    P2Quantile wait_p50;
+    P2Quantile wait_p95;
+    P2Quantile wait_p99;
+    TimeWeightedAverage queue_length;
+    TimeWeightedAverage busy_accounts;
+    ServiceRollup rollup;
+
+    void Read(const StreamingService& service) {
+        num_delays = service.num_delays;
+        num_served = service.num_served;
+        num_arrivals = service.num_arrivals;
+        num_queued = service.num_queued;
+        offered_minutes = service.offered_minutes;
+        total_delay = service.total_delay;
+        max_delay = service.max_delay;
+        time_in_queue = service.time_in_queue;
+        num_active_users = service.num_active_users;
+        wait_p50 = service.wait_p50;
+        wait_p95 = service.wait_p95;
+        wait_p99 = service.wait_p99;
+        queue_length = service.queue_length;
+        busy_accounts = service.busy_accounts;
+        rollup = service.rollup;
+    }
+    void Write(StreamingService& service) const {
+        service.num_delays = num_delays;
+        service.num_served = num_served;
+        service.num_arrivals = num_arrivals;
+        service.num_queued = num_queued;
+        service.offered_minutes = offered_minutes;
+        service.total_delay = total_delay;
+        service.max_delay = max_delay;
+        service.time_in_queue = time_in_queue;
+        service.num_active_users = num_active_users;
+        service.wait_p50 = wait_p50;
+        service.wait_p95 = wait_p95;
+        service.wait_p99 = wait_p99;
+        service.queue_length = queue_length;
+        service.busy_accounts = busy_accounts;
+        service.rollup = rollup;
+    }
+};
+
+// what one event did to its service's queue and active sessions: a customer that joined the queue
+// (ARRIVAL), or a session that ended and the customer that left the queue (DEPARTURE)
+struct ServiceChange {
+    int service;
+    int type;               // the event's type
+    int queued_cust;        // customer that joined or left the queue, -1 if none
+    int wait;               // DEPARTURE: the wait of the customer that left the queue
+    Session session;        // DEPARTURE: the session that ended
+};
+
+inline bool DepartsBefore(const TransactionRecord& a, const TransactionRecord& b) {
+    if (a.depart_time != b.depart_time) return a.depart_time < b.depart_time;
+    return a.cust_id < b.cust_id;
+}
+
+
+/*--------------------------------SHARDED SIMULATION--------------------------------*/
+class ShardedSimulation {
+    public:
+        Simulation sim;                 // customers, services and random streams, shared by the shards
+        int num_windows = 0;            // windows handled
+        int num_rollbacks = 0;          // windows rolled back and retried
+        int num_serial = 0;             // windows handled on one thread
+
+        // constructor, splits the services into at most num_shards shards of similar load
+        ShardedSimulation(unsigned long long seed, int replication, const SimulationConfig& config, int num_shards,
+                          TransactionLogWriter* transactions = NULL)
+            : sim(seed, replication, config) {
+            this->transactions = transactions;
+            int n = std::max(1, std::min(num_shards, config.NumServices()));
+            shards.resize(n);
+            for (int k = 0; k < n; k++) {
+                shards[k].index = k;
+                shards[k].outbox.resize(n);
+            }
+
+            // busiest services first, each to the shard with the least share so far
+            std::vector<int> order(config.NumServices());
+            for (int i = 0; i < config.NumServices(); i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&config](int a, int b) {
+                return config.services[a].share > config.services[b].share;
+            });
+            std::vector<double> load(n, 0);
+            shard_of.resize(config.NumServices());
+            slot_of.resize(config.NumServices());
+            for (size_t i = 0; i < order.size(); i++) {
+                int k = std::min_element(load.begin(), load.end()) - load.begin();
+                shard_of[order[i]] = k;
+                slot_of[order[i]] = shards[k].services.size();
+                shards[k].services.push_back(order[i]);
+                shards[k].saved.push_back(ServiceCounters());
+                shards[k].ended.push_back(std::vector<Session>());
+                shards[k].busy.push_back(0);
+                shards[k].left.push_back(0);
+                shards[k].joined.push_back(std::vector<int>());
+                load[k] += config.services[order[i]].share;
+            }
+
+            // hand out the initial arrivals
+            for (size_t i = 0; i < sim.events.heap.size(); i++)
+                shards[shard_of[sim.events.heap[i].service]].events.Push(sim.events.heap[i]);
+            sim.events.heap.clear();
+        }
+
+        int NumShards() const {
+            return (int)shards.size();
+        }
+
+        // run every window until the end time, one task per shard on the pool
+        void Run(ThreadPool& pool) {
+            while (true) {
+                int start = INT_MAX;
+                for (size_t k = 0; k < shards.size(); k++) {
+                    if (!shards[k].events.Empty())
+                        start = std::min(start, shards[k].events.Top().time);
+                }
+                if (start >= sim.end_time)
+                    break;
+                window_start = start;
+                window_end = std::min(start + min_service_time, sim.end_time);
+                num_windows++;
+
+                // end the window before the first arrival it is known to send another shard
+                for (size_t k = 0; k < shards.size(); k++)
+                    pool.Submit([this, k] { shards[k].horizon = Horizon(shards[k]); });
+                pool.Wait();
+                for (size_t k = 0; k < shards.size(); k++)
+                    window_end = std::min(window_end, shards[k].horizon);
+                if (window_end <= start) {
+                    window_end = start + 1;
+                    RerunWindow();
+                    num_serial++;
+                    sim.AdvanceRollups(window_end);
+                    PublishGauges();
+                    continue;
+                }
+
+                while (true) {
+                    first_conflict.store(INT_MAX, std::memory_order_relaxed);
+                    for (size_t k = 0; k < shards.size(); k++)
+                        pool.Submit([this, k] { RunWindow(shards[k]); });
+                    pool.Wait();
+
+                    int conflict = first_conflict.load(std::memory_order_relaxed);
+                    if (conflict == INT_MAX) {
+                        for (size_t k = 0; k < shards.size(); k++)
+                            pool.Submit([this, k] { Commit(shards[k]); });
+                        pool.Wait();
+                        for (size_t k = 0; k < shards.size(); k++)
+                            sim.num_events += shards[k].num_events;
+                        WriteTransactions();
+                        sim.AdvanceRollups(window_end);
+                        PublishGauges();
+                        break;
+                    }
+                    for (size_t k = 0; k < shards.size(); k++)
+                        Rollback(shards[k]);
+                    num_rollbacks++;
+                    if (conflict > start) {
+                        window_end = conflict;
+                        continue;
+                    }
+                    RerunWindow();
+                    num_serial++;
+                    sim.AdvanceRollups(window_end);
+                    PublishGauges();
+                    break;
+                }
+            }
+            sim.sys_time = sim.end_time;
+            if (sim.gauges != NULL)
+                sim.PublishGauges();
+            sim.FinishRollups();
+        }
+
+    private:
+        struct Shard {
+            int index;
+            std::vector<int> services;                  // services this shard handles
+            FutureEventList events;                     // pending events from the next window on
+            std::vector<Event> window_events;           // events Horizon took from 'events', in order
+            size_t window_size = 0;                     // how many of them are before the window's end
+            FutureEventList window;                     // events the current window created for itself
+            std::vector<Event> deferred;                // own events created for later windows
+            std::vector<std::vector<Event>> outbox;     // outbox[k]: events created for shard k's later windows
+            std::vector<TransactionRecord> records;     // departures in this window, in (time, cust_id) order
+            std::vector<ServiceCounters> saved;         // the services' counters as they were at the start of the window
+            std::vector<ServiceChange> changes;         // queue and session changes, in the order they were made
+            std::vector<CustomerRow> undo;              // customer rows as they were before each write
+            std::vector<std::vector<Session>> ended;    // ended[slot]: sessions a rolled back window ended, per service
+            FutureEventList ahead;                      // events Horizon's dry run created for itself
+            std::vector<int> busy;                      // busy[slot]: accounts in use in the dry run
+            std::vector<size_t> left;                   // left[slot]: customers that left the queue in the dry run
+            std::vector<std::vector<int>> joined;       // joined[slot]: customers that joined the queue in the dry run
+            int horizon = INT_MAX;                      // earliest arrival the coming window is known to send another shard
+            long long num_events = 0;                   // events handled in the current window
+        };
+
+        // what Simulation::Handle creates while a shard runs its window
+        struct ShardScheduler {
+            ShardedSimulation* owner;
+            Shard* shard;
+
+            void Schedule(const Event& ev) {
+                int dest = owner->shard_of[ev.service];
+                if (ev.time < owner->window_end) {
+                    if (dest == shard->index)
+                        shard->window.Push(ev);
+                    else
+                        owner->Conflict(ev.time);           // another shard may be past it already
+                }
+                else if (dest == shard->index) {
+                    shard->deferred.push_back(ev);
+                }
+                else {
+                    shard->outbox[dest].push_back(ev);
+                }
+            }
+            void Record(const TransactionRecord& record) {
+                if (owner->transactions != NULL)
+                    shard->records.push_back(record);
+            }
+            void Modify(int cust_id) {
+                shard->undo.push_back(CustomerRow::Read(owner->sim.customers, cust_id));
+            }
+        };
+
+        // what Simulation::Handle creates while a window is handled again on one thread
+        struct MergedScheduler {
+            ShardedSimulation* owner;
+            FutureEventList* window;
+
+            void Schedule(const Event& ev) {
+                if (ev.time < owner->window_end)
+                    window->Push(ev);
+                else
+                    owner->shards[owner->shard_of[ev.service]].events.Push(ev);
+            }
+            void Record(const TransactionRecord& record) {
+                if (owner->transactions != NULL)
+                    owner->transactions->Append(record);
+            }
+            void Modify(int) {
+            }
+        };
+
+        std::vector<Shard> shards;
+        std::vector<int> shard_of;                      // shard handling each service
+        std::vector<int> slot_of;                       // index of each service in its shard's lists
+        TransactionLogWriter* transactions;
+        int window_start = 0;                           // the current window is [window_start, window_end)
+        int window_end = 0;
+        std::atomic<int> first_conflict{INT_MAX};       // earliest arrival that landed inside the window at another shard
+        std::vector<TransactionRecord> merged;          // the window's departures from every shard
+
+        void RunWindow(Shard& shard) {
+            shard.deferred.clear();
+            shard.records.clear();
+            shard.changes.clear();
+            shard.undo.clear();
+            for (size_t k = 0; k < shard.outbox.size(); k++)
+                shard.outbox[k].clear();
+            for (size_t i = 0; i < shard.services.size(); i++)
+                shard.saved[i].Read(*sim.services[shard.services[i]]);
+
+            int end = window_end;
+            shard.window_size = std::partition_point(shard.window_events.begin(), shard.window_events.end(), [end](const Event& ev) {
+                return ev.time < end;
+            }) - shard.window_events.begin();
+            shard.window.heap.clear();
+
+            // after a conflict, events at or past it can only find later conflicts
+            ShardScheduler out = {this, &shard};
+            shard.num_events = 0;
+            size_t next = 0;
+            Event ev;
+            while (NextEvent(shard.window_events, shard.window_size, next, shard.window, ev)
+                   && ev.time < first_conflict.load(std::memory_order_relaxed)) {
+                const StreamingService& service = *sim.services[ev.service];
+                ServiceChange change = {ev.service, ev.type, -1, 0, Session()};
+                size_t queued = service.service_queue.size();
+                if (ev.type == DEPARTURE) {
+                    change.session = service.Sessions().front();
+                    if (queued > 0) {
+                        change.queued_cust = service.service_queue.front();
+                        change.wait = ev.time - sim.customers.time_of_queue[change.queued_cust];
+                    }
+                }
+                sim.Handle(ev, out);
+                // the sessions the window started are found by their start time instead
+                if (ev.type == DEPARTURE || service.service_queue.size() > queued) {
+                    if (ev.type == ARRIVAL)
+                        change.queued_cust = ev.cust_id;
+                    shard.changes.push_back(change);
+                }
+                shard.num_events++;
+            }
+        }
+
+        // take the coming window's events from the shard's list and return the earliest arrival the window
+        // sends to another shard, found by a dry run that follows only each service's busy accounts and queue.
+        // A queue leaver's next session is already drawn but for the minute it leaves, so its arrival is
+        // known without drawing it. Until another shard's arrival comes in the dry run is exact, so a window
+        // ending at every shard's horizon has no conflicts; a customer queued twice in one window is followed
+        // with its older session, which Conflict still catches.
+        int Horizon(Shard& shard) {
+            while (!shard.events.Empty() && shard.events.Top().time < window_end)
+                shard.window_events.push_back(shard.events.Pop());
+            shard.ahead.heap.clear();
+            for (size_t i = 0; i < shard.services.size(); i++) {
+                shard.busy[i] = sim.services[shard.services[i]]->num_active_users;
+                shard.left[i] = 0;
+                shard.joined[i].clear();
+            }
+
+            int horizon = INT_MAX;
+            size_t next = 0;
+            Event ev;
+            while (NextEvent(shard.window_events, shard.window_events.size(), next, shard.ahead, ev) && ev.time < horizon) {
+                const StreamingService& service = *sim.services[ev.service];
+                int i = slot_of[ev.service];
+                if (ev.type == ARRIVAL) {
+                    if (shard.busy[i] < service.num_accounts)
+                        shard.busy[i]++;
+                    else
+                        shard.joined[i].push_back(ev.cust_id);
+                    continue;
+                }
+                shard.busy[i]--;
+                size_t queued = service.service_queue.size();
+                if (shard.left[i] == queued + shard.joined[i].size())
+                    continue;
+                int cust = shard.left[i] < queued ? service.service_queue.at(shard.left[i]) : shard.joined[i][shard.left[i] - queued];
+                shard.left[i]++;
+                Event back = {0, cust, ARRIVAL, 0};
+                back.time = sim.customers.NextArrival(cust, sim.sampler, ev.time, back.service);
+                if (back < ev || back.time >= window_end)
+                    continue;
+                if (shard_of[back.service] == shard.index)
+                    shard.ahead.Push(back);
+                else
+                    horizon = std::min(horizon, back.time);
+            }
+            return horizon;
+        }
+
+        // between windows the services are quiescent and the window's end is the simulated time reached
+        void PublishGauges() {
+            if (sim.gauges == NULL)
+                return;
+            sim.sys_time = window_end;
+            sim.PublishGauges();
+        }
+
+        void Conflict(int time) {
+            int current = first_conflict.load(std::memory_order_relaxed);
+            while (time < current && !first_conflict.compare_exchange_weak(current, time, std::memory_order_relaxed)) {
+            }
+        }
+
+        // undo the window's queue changes newest first, then drop the sessions it started and put back the
+        // ones that ended. A session lasts at least a window, so the ones that ended started before it.
+        // The sessions end in a strict (depart_time, cust_id) order, so the rebuilt heaps release them
+        // exactly as before.
+        void Rollback(Shard& shard) {
+            for (size_t i = 0; i < shard.ended.size(); i++)
+                shard.ended[i].clear();
+            for (size_t i = shard.changes.size(); i-- > 0; ) {
+                const ServiceChange& change = shard.changes[i];
+                StreamingService& service = *sim.services[change.service];
+                if (change.type == DEPARTURE) {
+                    if (change.queued_cust != -1) {
+                        service.service_queue.push_front(change.queued_cust);
+                        service.wait_histogram.Remove(change.wait);
+                    }
+                    shard.ended[slot_of[change.service]].push_back(change.session);
+                }
+                else if (change.queued_cust != -1) {
+                    service.service_queue.pop_back();
+                }
+            }
+            for (size_t i = 0; i < shard.services.size(); i++) {
+                StreamingService& service = *sim.services[shard.services[i]];
+                size_t served = service.RestoreSessions(window_start, shard.ended[i]);
+                service.wait_histogram.counts[0] -= served;         // each was served without waiting
+                shard.saved[i].Write(service);
+            }
+            for (size_t i = shard.undo.size(); i-- > 0; )
+                shard.undo[i].Write(sim.customers);
+        }
+
+        // the earlier of the next of the first 'size' listed events and the next event the window created
+        static bool NextEvent(const std::vector<Event>& listed, size_t size, size_t& next, FutureEventList& created, Event& ev) {
+            if (next < size && (created.Empty() || listed[next] < created.Top()))
+                ev = listed[next++];
+            else if (!created.Empty())
+                ev = created.Pop();
+            else
+                return false;
+            return true;
+        }
+
+        // give the events Horizon took back to the shard's event list, from the first 'handled' on
+        static void Unlist(Shard& shard, size_t handled) {
+            for (size_t i = handled; i < shard.window_events.size(); i++)
+                shard.events.Push(shard.window_events[i]);
+            shard.window_events.clear();
+        }
+
+        // handle the window's events in the sequential engine's order, across all shards
+        void RerunWindow() {
+            FutureEventList window;
+            for (size_t k = 0; k < shards.size(); k++) {
+                Unlist(shards[k], 0);
+                while (!shards[k].events.Empty() && shards[k].events.Top().time < window_end)
+                    window.Push(shards[k].events.Pop());
+            }
+            MergedScheduler out = {this, &window};
+            while (!window.Empty()) {
+                sim.Handle(window.Pop(), out);
+                sim.num_events++;
+            }
+        }
+
+        // move the events created for later windows into the shards' event lists
+        void Commit(Shard& shard) {
+            Unlist(shard, shard.window_size);
+            for (size_t i = 0; i < shard.deferred.size(); i++)
+                shard.events.Push(shard.deferred[i]);
+            for (size_t k = 0; k < shards.size(); k++) {
+                const std::vector<Event>& inbox = shards[k].outbox[shard.index];
+                for (size_t i = 0; i < inbox.size(); i++)
+                    shard.events.Push(inbox[i]);
+            }
+        }
+
+        // append the window's departures in the order the sequential engine would have
+        void WriteTransactions() {
+            if (transactions == NULL)
+                return;
+            merged.clear();
+            for (size_t k = 0; k < shards.size(); k++)
+                merged.insert(merged.end(), shards[k].records.begin(), shards[k].records.end());
+            std::sort(merged.begin(), merged.end(), DepartsBefore);
+            for (size_t i = 0; i < merged.size(); i++)
+                transactions->Append(merged[i]);
+        }
+};
+/*----------------------------------------------------------------------------------*/
+
+#endif
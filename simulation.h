@@ -0,0 +1,874 @@
+/****************************************************************************************
+    simulation.h
+
+    The shared streaming service model: the customers, the streaming services and the
+    event-driven engine that runs one replication of the simulation. Everything a
+    replication touches lives in its Simulation object, so several can run at once.
+****************************************************************************************/
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdio.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include "transaction_log.h"
+#include "delay_stats.h"
+#include "sampling.h"
+#include "instrumentation.h"
+#include "rollups.h"
+
+/*--------------------------GLOBAL CONSTANTS--------------------------*/
+const double our_monthly_fee = 20;         // price customer pays for our service
+const double mean_service_time = 150;      // mean service time in minutes 
+const int num_customers = 10000;           // number of customers in total
+const int num_services = 6;                // number of streaming services
+const int month_min = 60*24*31;            // one month of simulation in minutes
+const int num_months = 2;                  // number of months to run the simulation
+inline bool VIEW_LIVE_TRANSACTIONS = false; // set to 'true' if you want to view the live transactions in the terminal
+/*-------------------------CONST GLOBAL ARRAYS------------------------*/
+const std::string service_names[num_services] = {"Netflix", "Disney+", "CraveTv", "Prime", "Paramount+", "AppleTv+"};
+const double service_costs[num_services] = {9.99, 11.99, 9.99, 9.99, 9.99, 8.99};
+const int service_accounts[num_services] = {300, 200, 200, 200, 50, 50};
+const double service_shares[num_services] = {0.30, 0.20, 0.20, 0.20, 0.05, 0.05};     // probability a session picks each service
+/*--------------------------------------------------------------------*/
+
+// one streaming service on offer
+struct ServiceSpec {
+    std::string name;
+    double cost;            // monthly cost of one account
+    double share;           // relative probability that a customer's session picks this service
+};
+
+// the services in the global arrays above
+inline std::vector<ServiceSpec> DefaultServices() {
+    std::vector<ServiceSpec> services(num_services);
+    for (int i = 0; i < num_services; i++)
+        services[i] = {service_names[i], service_costs[i], service_shares[i]};
+    return services;
+}
+
+// the configured number of accounts for each service, as a vector a run can vary
+inline std::vector<int> DefaultAccounts() {
+    return std::vector<int>(service_accounts, service_accounts + num_services);
+}
+
+// what one run simulates; defaults to the global constants above
+struct SimulationConfig {
+    std::vector<ServiceSpec> services = DefaultServices();     // the services customers choose between (at most 256)
+    std::vector<int> accounts = DefaultAccounts();      // number of accounts held for each service
+    int num_customers = ::num_customers;                // number of customers in total
+    int num_months = ::num_months;                      // number of months to run the simulation
+    bool antithetic = false;                            // odd replications reuse the even one's draws, complemented
+    bool control_variates = false;                      // adjust the estimates by the known mean offered load
+    double arrival_spacing = 1;                         // minutes between consecutive customers' first arrival windows
+
+    int NumServices() const {
+        return (int)services.size();
+    }
+    std::vector<std::string> ServiceNames() const {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < services.size(); i++)
+            names.push_back(services[i].name);
+        return names;
+    }
+};
+
+// the service choice weights, in catalog order
+inline std::vector<double> ServiceShares(const SimulationConfig& config) {
+    std::vector<double> shares;
+    for (int i = 0; i < config.NumServices(); i++)
+        shares.push_back(config.services[i].share);
+    return shares;
+}
+
+// monthly account costs against subscription revenue over the simulated months
+struct CostRevenue {
+    double total_cost = 0;
+    double revenue = 0;
+    double profit = 0;
+    double break_even_fee = 0;      // monthly fee at which revenue just covers the account costs
+};
+
+inline CostRevenue ComputeCostRevenue(const SimulationConfig& config, double monthly_fee = our_monthly_fee) {
+    CostRevenue result;
+    for (int i = 0; i < config.NumServices(); i++)
+    {
+        result.total_cost += config.services[i].cost * config.accounts[i] * config.num_months;
+    }
+    result.revenue = (double)config.num_customers * monthly_fee * config.num_months;
+    result.profit = result.revenue - result.total_cost;
+    result.break_even_fee = result.total_cost / ((double)config.num_customers * config.num_months);
+    return result;
+}
+
+
+/*--------------------------------CUSTOMER SAMPLER--------------------------------*/
+const int min_service_time = 30;            // shortest session CustomerSampler::ServiceTime draws
+const int service_time_spread = 150;        // sessions last min_service_time + [0, service_time_spread) minutes
+
+// window a customer's next arrival falls in, in minutes from the start of the day they left service
+struct ArrivalWindow {
+    int start;              // from_time_of_day starts the window at the minute they left
+    int end;                // inclusive
+};
+const int from_time_of_day = -1;
+
+// leaving service before 12pm: 10% between time_of_day and 1pm, 50% between 1pm-9pm, 40% between 9pm-1am
+const ArrivalWindow morning_windows[3] = {{from_time_of_day, 60*13}, {60*13, 60*21}, {60*21, 60*25}};
+const double morning_window_shares[3] = {0.1, 0.5, 0.4};
+// leaving service after 12pm: 40% between time_of_day and 1am, 10% between 1am-9am, 50% between 9am-1pm (next day)
+const ArrivalWindow afternoon_windows[3] = {{from_time_of_day, 60*25}, {60*24 + 60, 60*24 + 60*9}, {60*24 + 60*9, 60*24 + 60*13}};
+const double afternoon_window_shares[3] = {0.4, 0.1, 0.5};
+
+// every random choice a customer makes, drawn from Philox keyed by the seed: session s of
+// customer c (their s-th choice of service, arrival and service time) is the single block at
+// counter (c, s, replication, 0), one word per choice, so a replication's results depend only
+// on (seed, replication) and any session can be recomputed without replaying the others
+class CustomerSampler {
+    public:
+        // constructor, service_shares weights the service choice; with antithetic, replications 2k and 2k+1
+        // share one stream and 2k+1 gets every word complemented (so every uniform u becomes 1-u)
+        CustomerSampler(unsigned long long seed, int replication, const std::vector<double>& service_shares, bool antithetic = false)
+            : service_choice(service_shares),
+              morning_choice(std::vector<double>(morning_window_shares, morning_window_shares + 3)),
+              afternoon_choice(std::vector<double>(afternoon_window_shares, afternoon_window_shares + 3)) {
+            key[0] = (uint32_t)seed;
+            key[1] = (uint32_t)(seed >> 32);
+            this->replication = antithetic ? replication / 2 : replication;
+            flip = antithetic && replication % 2 == 1 ? 0xFFFFFFFFu : 0;
+        }
+
+        // the four words of one session
+        void Draw(int cust_id, uint32_t session, uint32_t words[4]) const {
+            uint32_t counter[4] = {(uint32_t)cust_id, session, replication, 0};
+            Philox4x32(counter, key, words);
+            for (int k = 0; k < 4; k++)
+                words[k] ^= flip;
+        }
+        // the words of the same session for count consecutive customers, 4 per customer
+        void DrawBatch(int first_cust, int count, uint32_t session, uint32_t* words) const {
+            Philox4x32Fill((uint32_t)first_cust, session, replication, 0, key, count, words);
+            if (flip != 0) {
+                for (int k = 0; k < 4*count; k++)
+                    words[k] ^= flip;
+            }
+        }
+
+        int ChooseService(uint32_t word) const {
+            return service_choice.Sample(word);
+        }
+
+        // minute of the next arrival for a customer leaving service at sys_time
+        int ArrivalTime(uint32_t window_word, uint32_t time_word, int sys_time) const {
+            int time_of_day = sys_time % 60*24;
+            const ArrivalWindow& window = time_of_day < 60*12 ? morning_windows[morning_choice.Sample(window_word)]
+                                                              : afternoon_windows[afternoon_choice.Sample(window_word)];
+            int start = window.start == from_time_of_day ? time_of_day : window.start;
+            return (sys_time - time_of_day) + start + ToBelow(time_word, window.end - start + 1);
+        }
+
+        // test --> uniform distribution between 0.5 and 3 hours (30 minutes - 180 minutes)
+        static int ServiceTime(uint32_t word) {
+            //return round(-mean_service_time * log(ToUniform(word)) + 1);
+            return min_service_time + (int)(ToUniform(word) * service_time_spread);
+        }
+        // exact mean of ServiceTime over a uniform word
+        static double MeanServiceTime() {
+            return min_service_time + (service_time_spread - 1) / 2.0;
+        }
+
+    private:
+        uint32_t key[2];
+        uint32_t replication;                   // the stream's counter word
+        uint32_t flip;                          // xor-ed into every word, all ones for the antithetic half of a pair
+        AliasTable service_choice;
+        AliasTable morning_choice;
+        AliasTable afternoon_choice;
+};
+
+// the words of a session, in the order they are used
+const int SERVICE_WORD = 0;
+const int WINDOW_WORD = 1;
+const int ARRIVAL_WORD = 2;
+const int SERVICE_TIME_WORD = 3;
+/*--------------------------------------------------------------------------------*/
+
+
+/*-------------------------------FUTURE EVENT LIST-------------------------------*/
+// event types; an arrival sorts before a departure of the same customer in the same minute
+const int ARRIVAL = 0;
+const int DEPARTURE = 1;
+
+struct Event {
+    int time;       // simulated minute the event happens at
+    int cust_id;    // customer the event belongs to
+    int type;       // ARRIVAL or DEPARTURE
+    int service;    // service the customer arrives at or departs from (not part of the order)
+
+    // events are ordered by (time, cust_id, type), the order the old minute-by-minute scan visited them in
+    bool operator<(const Event& other) const {
+        if (time != other.time) return time < other.time;
+        if (cust_id != other.cust_id) return cust_id < other.cust_id;
+        return type < other.type;
+    }
+    bool operator>(const Event& other) const {
+        return other < *this;
+    }
+};
+
+// binary min-heap of pending events, so the simulation jumps straight to the next event
+class FutureEventList {
+    public:
+        std::vector<Event> heap;
+
+        void Reserve(size_t n) {
+            heap.reserve(n);
+        }
+        bool Empty() const {
+            return heap.empty();
+        }
+        const Event& Top() const {
+            return heap.front();
+        }
+        void Push(const Event& ev) {
+            heap.push_back(ev);
+            std::push_heap(heap.begin(), heap.end(), std::greater<Event>());
+        }
+        Event Pop() {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<Event>());
+            Event ev = heap.back();
+            heap.pop_back();
+            return ev;
+        }
+};
+/*-------------------------------------------------------------------------------*/
+
+
+/*-------------------------------CUSTOMER TABLE-------------------------------*/
+// every customer's fields in parallel arrays indexed by cust_id, so millions of customers
+// take a few contiguous allocations instead of one heap object each
+class CustomerTable {
+    public:
+        std::vector<int> arrival_time;
+        std::vector<int> service_time;
+        std::vector<int> depart_time;
+        std::vector<int> time_of_queue;
+        std::vector<int> delay_time;
+        std::vector<unsigned char> chosen_service;
+        std::vector<uint32_t> session;                // sessions sampled so far, the counter of the next one
+
+        // constructor
+        CustomerTable(int num_customers) {
+            arrival_time.assign(num_customers, 0);
+            service_time.assign(num_customers, 0);
+            depart_time.assign(num_customers, -1);
+            time_of_queue.assign(num_customers, 0);
+            delay_time.assign(num_customers, 0);
+            chosen_service.assign(num_customers, 0);
+            session.assign(num_customers, 0);
+        }
+
+        int Size() const {
+            return (int)arrival_time.size();
+        }
+
+        // start a customer's next session from its four sampled words
+        void StartSession(int cust_id, const CustomerSampler& sampler, const uint32_t words[4], int sys_time, int offset = 0) {
+            chosen_service[cust_id] = sampler.ChooseService(words[SERVICE_WORD]);
+            arrival_time[cust_id] = sampler.ArrivalTime(words[WINDOW_WORD], words[ARRIVAL_WORD], sys_time) + offset;
+            service_time[cust_id] = CustomerSampler::ServiceTime(words[SERVICE_TIME_WORD]);
+            session[cust_id]++;
+        }
+
+        // minute and service of the session ReInitializeCustomer would start at sys_time, without starting it
+        int NextArrival(int cust_id, const CustomerSampler& sampler, int sys_time, int& service) const {
+            uint32_t words[4];
+            sampler.Draw(cust_id, session[cust_id], words);
+            service = sampler.ChooseService(words[SERVICE_WORD]);
+            return sampler.ArrivalTime(words[WINDOW_WORD], words[ARRIVAL_WORD], sys_time);
+        }
+
+        void ReInitializeCustomer(int cust_id, const CustomerSampler& sampler, int sys_time) {
+            INSTRUMENT_PHASE(PHASE_REINITIALIZE);
+            uint32_t words[4];
+            sampler.Draw(cust_id, session[cust_id], words);
+            StartSession(cust_id, sampler, words, sys_time);
+        }
+};
+/*---------------------------------------------------------------------------*/
+
+
+/*------------------------------------STREAMING SERVICE CLASS------------------------------------*/
+// a customer using one of a service's accounts, with the fields of its transaction record
+struct Session {
+    int depart_time;
+    int cust_id;
+    int arrival_time;
+    int service_time;
+    int delay_time;
+
+    // sessions end in (depart_time, cust_id) order, the order of their departure events
+    bool operator>(const Session& other) const {
+        if (depart_time != other.depart_time) return depart_time > other.depart_time;
+        return cust_id > other.cust_id;
+    }
+};
+
+// first-in first-out queue of customer ids in a ring buffer; the buffer doubles when full and is
+// never shrunk, so a service stops allocating once its queue has reached its peak
+class CustomerQueue {
+    public:
+        // constructor, capacity is rounded up to a power of two
+        explicit CustomerQueue(size_t capacity = 16) {
+            size_t n = 1;
+            while (n < capacity)
+                n <<= 1;
+            ids.resize(n);
+        }
+
+        bool empty() const {
+            return count == 0;
+        }
+        size_t size() const {
+            return count;
+        }
+        int front() const {
+            return ids[head];
+        }
+        // the i-th customer from the front
+        int at(size_t i) const {
+            return ids[(head + i) & (ids.size() - 1)];
+        }
+
+        void push(int cust_id) {
+            if (count == ids.size())
+                Grow();
+            ids[(head + count) & (ids.size() - 1)] = cust_id;
+            count++;
+        }
+        void pop() {
+            head = (head + 1) & (ids.size() - 1);
+            count--;
+        }
+
+        // the reverse of pop and push, to take back a customer that left or joined the queue
+        void push_front(int cust_id) {
+            if (count == ids.size())
+                Grow();
+            head = (head - 1) & (ids.size() - 1);
+            ids[head] = cust_id;
+            count++;
+        }
+        void pop_back() {
+            count--;
+        }
+
+        // replace the contents with 'n' customers, front first
+        void assign(const int* first, size_t n) {
+            head = 0;
+            count = 0;
+            for (size_t i = 0; i < n; i++)
+                push(first[i]);
+        }
+
+    private:
+        std::vector<int> ids;
+        size_t head = 0;
+        size_t count = 0;
+
+        // double the buffer, unwrapping the queue to its start
+        void Grow() {
+            std::vector<int> larger(ids.size() * 2);
+            for (size_t i = 0; i < count; i++)
+                larger[i] = at(i);
+            ids.swap(larger);
+            head = 0;
+        }
+};
+
+class StreamingService {
+    public:
+        int num_accounts;                             // number of accounts for the service
+        double cost;                                  // monthly cost for the streaming service
+        std::string name;                             // streaming service name
+        // queue delay variables
+        long long num_delays = 0;
+        long long num_served = 0;                     // number of customers that entered service
+        long long num_arrivals = 0;                   // sessions started for this service, served or queued
+        long long num_queued = 0;                     // of those, the ones that found every account busy
+        long long offered_minutes = 0;                // service time those sessions asked for
+        long long total_delay = 0;
+        int max_delay = 0;
+        long long time_in_queue = 0;
+        int num_active_users = 0;                     // number of active users (initially zero)
+        CustomerQueue service_queue;                  // queue for users (customer ids)
+        // wait time distribution (every customer that starts a session, 0 if served immediately)
+        P2Quantile wait_p50 = P2Quantile(0.50);
+        P2Quantile wait_p95 = P2Quantile(0.95);
+        P2Quantile wait_p99 = P2Quantile(0.99);
+        LogHistogram wait_histogram;
+        // time-weighted averages over the whole run
+        TimeWeightedAverage queue_length;
+        TimeWeightedAverage busy_accounts;
+        ServiceRollup rollup;                         // day and hour-of-day windows, when rollups are kept
+        
+        // function to convert time in int to string with leading zeros
+        static std::string StringTime(int arg) {
+            size_t n = 2;   // date and clock time use 2 digits always (leading zeros)
+            return std::string(n - std::min(n, std::to_string(arg).length()), '0') + std::to_string(arg);
+        }
+
+        // constructor
+        StreamingService(const int num_accounts, const double cost, const std::string name) {
+            this->num_accounts = num_accounts;
+            this->cost = cost;
+            this->name = name;
+            active_sessions.reserve(num_accounts);
+            service_queue = CustomerQueue(std::max(16, num_accounts));
+        }
+
+        // time the earliest session ends (INT_MAX with every account free); its departure is the
+        // next one ReleaseCustomer handles
+        int NextDeparture() const {
+            return active_sessions.empty() ? INT_MAX : active_sessions.front().depart_time;
+        }
+        // customer whose session ends first, -1 with every account free
+        int NextDeparting() const {
+            return active_sessions.empty() ? -1 : active_sessions.front().cust_id;
+        }
+
+        // the sessions using an account, in heap order (the earliest departure first)
+        const std::vector<Session>& Sessions() const {
+            return active_sessions;
+        }
+        // replace the sessions with 'n' sessions already in heap order, as a snapshot saved them
+        void AssignSessions(const Session* first, size_t n) {
+            active_sessions.assign(first, first + n);
+        }
+        // take back everything since start_time: drop the sessions that started since then and put
+        // back the ones that ended (which started before it, as a session outlasts the window);
+        // returns the number of sessions dropped
+        size_t RestoreSessions(int start_time, const std::vector<Session>& ended) {
+            size_t size = active_sessions.size();
+            active_sessions.erase(std::remove_if(active_sessions.begin(), active_sessions.end(), [start_time](const Session& session) {
+                return session.depart_time - session.service_time >= start_time;
+            }), active_sessions.end());
+            size_t dropped = size - active_sessions.size();
+            active_sessions.insert(active_sessions.end(), ended.begin(), ended.end());
+            std::make_heap(active_sessions.begin(), active_sessions.end(), std::greater<Session>());
+            return dropped;
+        }
+
+        // function to serve customers, or add them to queue if the service is full
+        // returns true if the customer entered service (and now has a departure time)
+        bool ServeCustomer(CustomerTable& customers, int cust_id, int sys_time) {
+            INSTRUMENT_PHASE(PHASE_SERVE);
+            num_arrivals++;
+            offered_minutes += customers.service_time[cust_id];
+            if (num_active_users < num_accounts) {                  // if the service is available, then
+                num_active_users++;                                 // increment the number of active users
+                busy_accounts.Update(sys_time, num_active_users);
+                if (rollup.enabled) {
+                    rollup.Arrival(sys_time, false);
+                    rollup.Busy(sys_time, num_active_users);
+                }
+                RecordWait(0);                                      // served without waiting
+                customers.depart_time[cust_id] = sys_time + customers.service_time[cust_id];  // calculate the departure time
+                active_sessions.push_back({customers.depart_time[cust_id], cust_id, customers.arrival_time[cust_id],
+                                           customers.service_time[cust_id], customers.delay_time[cust_id]});
+                std::push_heap(active_sessions.begin(), active_sessions.end(), std::greater<Session>());   // add user to the active sessions
+                num_served++;                                       // increase the number of interactions
+                if (VIEW_LIVE_TRANSACTIONS == true)
+                    std::cout << "\033[1;32mCustomer " << cust_id << " entered service " << name << " at time " << GetDateTime(sys_time) << " and will leave at time " << GetDateTime(customers.depart_time[cust_id]) << "\n";
+                return true;
+            }
+            else {
+                service_queue.push(cust_id);                        // add customer to queue
+                num_queued++;
+                queue_length.Update(sys_time, service_queue.size());
+                customers.time_of_queue[cust_id] = sys_time;        // set the time of queue for the customer
+                if (rollup.enabled)
+                    rollup.Arrival(sys_time, true);
+                if (VIEW_LIVE_TRANSACTIONS == true)
+                    std::cout << "\033[1;33mCustomer " << cust_id << " entered queue for service " << name << " at time " << GetDateTime(sys_time) << "\n";
+                return false;
+            }
+        }
+
+        // function to release customers that are ready to be released, and serve queued customers when a customer leaves;
+        // the session that ended (always the earliest departure) is copied to 'ended'
+        // returns the customer that left the queue (already reinitialized), or -1 if the queue was empty
+        int ReleaseCustomer(CustomerTable& customers, int cust_id, int sys_time, const CustomerSampler& sampler, Session& ended) {
+            INSTRUMENT_PHASE(PHASE_RELEASE);
+            assert(NextDeparting() == cust_id);                     // departure events come in the heap's order
+            std::pop_heap(active_sessions.begin(), active_sessions.end(), std::greater<Session>());   // remove the user from the active sessions
+            ended = active_sessions.back();
+            active_sessions.pop_back();
+            num_active_users--;                                     // decrease the active users count
+            busy_accounts.Update(sys_time, num_active_users);
+            if (rollup.enabled)
+                rollup.Busy(sys_time, num_active_users);
+            if (VIEW_LIVE_TRANSACTIONS == true)
+                std::cout << "\033[1;31mCustomer " << cust_id << " left service " << name << " at time " << GetDateTime(sys_time) << "\n";
+            if (service_queue.size() > 0) {                         // if there is queued customers, then
+                int q_cust = service_queue.front();                 // get the customer at the front of queue
+                service_queue.pop();                                // remove that customer from the queue
+                queue_length.Update(sys_time, service_queue.size());
+                int delay = sys_time - customers.time_of_queue[q_cust];
+                RecordWait(delay);
+                if (rollup.enabled)
+                    rollup.Wait(sys_time, delay);
+                customers.delay_time[q_cust] = delay;               // calculate the delay time for the customer
+                total_delay += delay;                               // increase the total delay time for this service queue
+                if (delay != 0)                                     // if customer spent time in queue, then
+                    num_delays++;                                   // increment the number of delays for this service
+                if (delay > max_delay)                              // if customer delay is largest delay, then
+                    max_delay = delay;                              // set the maximum delay to customer delay
+                // reinitialize the customer (choose service, get service time); the customer leaves the queue
+                // straight into its next session without holding one of this service's accounts
+                customers.ReInitializeCustomer(q_cust, sampler, sys_time);
+                if (service_queue.size() > 0)                       // if the queue is not empty, then
+                    time_in_queue++;                                // increment the time in queue
+                if (VIEW_LIVE_TRANSACTIONS == true)
+                    std::cout << "\033[1;34mCustomer " << q_cust << " left queue for service " << name << " at time " << GetDateTime(sys_time) << "\n";
+                return q_cust;
+            }
+            return -1;
+        }
+
+        // add one customer's wait to the wait time distribution
+        void RecordWait(int wait) {
+            wait_p50.Add(wait);
+            wait_p95.Add(wait);
+            wait_p99.Add(wait);
+            wait_histogram.Add(wait);
+        }
+
+        // function to get the time as month-day hours:minutes
+        static std::string GetDateTime(int time) {
+            int months = (int)((float)time / (float)month_min);
+            int days = (int)((float)(time - months*month_min) / (float)(24*60));
+            int hours = (int)((float)(time - months*month_min - days*24*60) / (float)(60));
+            int minutes = time - months*month_min - days*24*60 - hours*60;
+            return StringTime(months+1) + "/" + StringTime(days+1) + "/2023" + " " + StringTime(hours) + ":" + StringTime(minutes);
+        }
+        static std::string GetTime(int time) {
+            int hours = (int)((float)time / (float)60);
+            int minutes = time - hours*60;
+            return StringTime(hours) + ":" + StringTime(minutes);
+        }
+
+        // function for probability of delay, relative to the interactions across all services
+        double ProbDelay(long long num_interactions) {
+            return (double)num_delays / (double)num_interactions;
+        }
+        // function for probability of delay of this service's own customers: the chance an arrival here finds
+        // every account busy, counted when it arrives (so customers still queued at the end count too)
+        double ServiceProbDelay() {
+            return num_arrivals > 0 ? (double)num_queued / (double)num_arrivals : NAN;
+        }
+        // function for average delay time
+        double AvgDelay() {
+            return (double)total_delay / (double)num_delays;
+        }
+        // function for queue utilization
+        double QueueUtil(int sys_time) {
+            return (double)time_in_queue * 100 / (double)sys_time;
+        }
+
+    private:
+        std::vector<Session> active_sessions;         // min-heap of the sessions using an account, at most num_accounts
+};
+/*-----------------------------------------------------------------------------------------------*/
+
+inline double LittlesLaw(int sys_time, long long num_delays, double avg_delay) {
+    double lambda = (double)num_delays / (double)sys_time;
+    return lambda * avg_delay;
+
+}
+
+
+/*------------------------------------SERVICE METRICS------------------------------------*/
+// end-of-run queueing results for one streaming service in one replication
+struct ServiceMetrics {
+    double avg_cust_in_queue;       // Little's law estimate of the queue contents
+    double queue_util;              // queue utilization (%)
+    double num_delays;              // instances of queue
+    double prob_delay;              // probability of queue, relative to the interactions across all services
+    double service_prob_delay;      // probability of queue of this service's own arrivals (what service levels are judged on)
+    double avg_delay;               // average queue time (mins)
+    double max_delay;               // maximum queue time (mins)
+    double wait_p50;                // median wait (mins), counting customers served immediately as 0
+    double wait_p95;                // 95th percentile wait (mins)
+    double wait_p99;                // 99th percentile wait (mins)
+    double avg_queue_length;        // time-weighted average number of customers in queue
+    double avg_busy_accounts;       // time-weighted average number of accounts in use
+    double offered_load;            // service minutes asked of this service per arrival (at any service)
+    double expected_offered_load;   // its known mean: share of the choice * mean service time
+    std::vector<long long> wait_histogram;      // LogHistogram bucket counts of the waits
+};
+/*---------------------------------------------------------------------------------------*/
+
+
+/*------------------------------------SIMULATION CLASS------------------------------------*/
+// where the sequential engine puts what Simulation::Handle creates
+struct EventListScheduler {
+    FutureEventList* events;
+    TransactionLogWriter* transactions;       // NULL to skip
+
+    void Schedule(const Event& ev) {
+        events->Push(ev);
+    }
+    void Record(const TransactionRecord& record) {
+        if (transactions != NULL)
+            transactions->Append(record);     // hand the transaction data to the log writer thread
+    }
+    void Modify(int) {
+    }
+};
+
+// one replication: its own random stream, streaming services, customers and event list
+class Simulation {
+    public:
+        unsigned long long seed;
+        int replication;
+        SimulationConfig config;
+        CustomerSampler sampler;                      // every random draw of this replication
+        std::vector<StreamingService*> services;      // the streaming services, as listed in config
+        CustomerTable customers;                      // every customer's fields, indexed by cust_id
+        FutureEventList events;                       // pending arrivals and departures
+        int sys_time = 0;                             // simulated time
+        int end_time;                                 // simulated time the run stops at
+        int arrival_of_last_customer = 0;
+        long long num_events = 0;                     // events handled so far
+        TransactionLogWriter* transactions;           // where to write transaction data (NULL to skip)
+        SimulationGauges* gauges = NULL;              // what PublishGauges reports to the metrics reporter, when instrumented
+        RollupWriter* rollups = NULL;                 // where finished day windows go (NULL to skip), see SetRollups
+
+        // constructor; without initialize_customers the customers and event list are left empty
+        // for RestoreSnapshot to fill in
+        Simulation(unsigned long long seed, int replication, const SimulationConfig& config, TransactionLogWriter* transactions = NULL,
+                   bool initialize_customers = true)
+            : config(config), sampler(seed, replication, ServiceShares(config), config.antithetic), customers(config.num_customers) {
+            this->seed = seed;
+            this->replication = replication;
+            this->transactions = transactions;
+            end_time = config.num_months*month_min;
+
+            /*---------------------------INITIALIZE STREAMING SERVICES---------------------------*/
+            for (int i=0; i < config.NumServices(); i++) {
+                services.push_back(new StreamingService(config.accounts[i], config.services[i].cost, config.services[i].name));
+            }
+#if SIMULATION_INSTRUMENTATION
+            if (INSTRUMENTATION_ENABLED) {
+                gauges = new SimulationGauges(replication, config.ServiceNames());
+                gauges->end_time.store(end_time, std::memory_order_relaxed);
+                MetricsRegistry::Instance().Register(gauges);
+            }
+#endif
+
+            /*-------------------------------INITIALIZE CUSTOMERS--------------------------------*/
+            if (!initialize_customers)
+                return;
+            events.Reserve(config.num_customers);     // a customer has at most one pending event
+            const int batch = 4096;                   // first sessions are drawn a batch of customers at a time
+            std::vector<uint32_t> words(4*batch);
+            for (int first = 0; first < config.num_customers; first += batch) {
+                int count = std::min(batch, config.num_customers - first);
+                sampler.DrawBatch(first, count, 0, words.data());
+                for (int i = first; i < first + count; i++) {
+                    customers.StartSession(i, sampler, &words[4*(i - first)], 0, (int)(i * config.arrival_spacing));
+                    events.Push({customers.arrival_time[i], i, ARRIVAL, customers.chosen_service[i]});
+
+                    // if the customer is the last one to enter service, record their time of arrival
+                    if (customers.arrival_time[i] > arrival_of_last_customer)
+                        arrival_of_last_customer = customers.arrival_time[i];
+                }
+            }
+        }
+
+        // destructor
+        ~Simulation() {
+            for (size_t i=0; i < services.size(); i++)
+                delete services[i];
+#if SIMULATION_INSTRUMENTATION
+            if (gauges != NULL)
+                MetricsRegistry::Instance().Unregister(gauges);         // the registry keeps the last values
+#endif
+        }
+
+        // schedule a customer's next arrival, unless it falls at or before the event being handled;
+        // the old minute-by-minute scan had already passed such a customer for that minute and never saw it again
+        template <typename Scheduler>
+        void ScheduleArrival(int cust_id, const Event& current, Scheduler& out) {
+            Event next = {customers.arrival_time[cust_id], cust_id, ARRIVAL, customers.chosen_service[cust_id]};
+            if (next < current)
+                return;
+            out.Schedule(next);
+        }
+
+        // handle one event, handing every event it creates and every transaction it completes to 'out';
+        // out.Modify(cust_id) is told before a customer's fields are written. Only the event's service
+        // and the customers it touches are used, so a sharded run can handle events of different
+        // services at once.
+        template <typename Scheduler>
+        void Handle(const Event& ev, Scheduler& out) {
+            INSTRUMENT_PHASE(PHASE_DISPATCH);
+            int cust = ev.cust_id;
+            StreamingService* service = services[ev.service];
+
+            if (ev.type == ARRIVAL) {
+                /* serve new customers */
+                out.Modify(cust);
+                if (service->ServeCustomer(customers, cust, ev.time)) {
+                    Event departure = {customers.depart_time[cust], cust, DEPARTURE, ev.service};
+                    out.Schedule(departure);
+                    // the customer's next session starts when it leaves; it is drawn now (the draws depend only on
+                    // the customer, its session count and the departure time) so its next arrival is known a
+                    // whole service time ahead
+                    customers.ReInitializeCustomer(cust, sampler, departure.time);
+                    ScheduleArrival(cust, departure, out);
+                }
+            }
+            else {
+                if (!service->service_queue.empty())
+                    out.Modify(service->service_queue.front());
+                Session ended;
+                int q_cust = service->ReleaseCustomer(customers, cust, ev.time, sampler, ended);
+                if (q_cust != -1)
+                    ScheduleArrival(q_cust, ev, out);
+
+                // after all customers have entered the system at least once
+                if (ev.time >= arrival_of_last_customer)
+                    out.Record({cust, ev.service, ended.arrival_time, ended.depart_time, ended.service_time, ended.delay_time});
+            }
+        }
+
+        // run customers through the simulation until the end time
+        void Run() {
+            RunUntil(end_time);
+            sys_time = end_time;
+            if (gauges != NULL)
+                PublishGauges();
+            FinishRollups();
+        }
+
+        // keep day and hour-of-day windows for every service from the current time on, written to 'writer'
+        void SetRollups(RollupWriter* writer) {
+            rollups = writer;
+            for (size_t i = 0; i < services.size(); i++)
+                services[i]->rollup.Start(sys_time, services[i]->num_active_users);
+            next_rollup_day = (sys_time / rollup_day + 1) * rollup_day;
+        }
+
+        // end every day window before 'time' and write the days all services have finished;
+        // only called between events
+        void AdvanceRollups(int time) {
+            if (rollups == NULL)
+                return;
+            std::vector<ServiceRollup*> windows;
+            for (size_t i = 0; i < services.size(); i++) {
+                services[i]->rollup.AdvanceTo(time);
+                windows.push_back(&services[i]->rollup);
+            }
+            rollups->Drain(windows);
+            next_rollup_day = (time / rollup_day + 1) * rollup_day;
+        }
+
+        // write the last day and the hour-of-day windows at the end of the run
+        void FinishRollups() {
+            if (rollups == NULL)
+                return;
+            std::vector<ServiceRollup*> windows;
+            for (size_t i = 0; i < services.size(); i++)
+                windows.push_back(&services[i]->rollup);
+            rollups->Finish(windows, end_time);
+        }
+
+        // handle every event before stop_time (and before the end time); the run can be resumed
+        // from here, which is where a snapshot of the warmed-up state is taken
+        void RunUntil(int stop_time) {
+            stop_time = std::min(stop_time, end_time);
+            EventListScheduler out = {&events, transactions};
+            while (!events.Empty() && events.Top().time < stop_time) {
+                Event ev = events.Pop();
+                if (rollups != NULL && ev.time >= next_rollup_day)
+                    AdvanceRollups(ev.time);
+                sys_time = ev.time;
+                Handle(ev, out);
+                num_events++;
+                if (gauges != NULL && num_events % gauge_interval_events == 0)
+                    PublishGauges();
+            }
+            if (gauges != NULL)
+                PublishGauges();
+        }
+
+        // hand the simulated time and every service's queue depth and active sessions to the metrics
+        // reporter; only called between events, so the services are not being changed
+        void PublishGauges() {
+#if SIMULATION_INSTRUMENTATION
+            gauges->sys_time.store(sys_time, std::memory_order_relaxed);
+            gauges->events.store(num_events, std::memory_order_relaxed);
+            for (size_t i = 0; i < services.size(); i++) {
+                gauges->queue_depth[i].store(services[i]->service_queue.size(), std::memory_order_relaxed);
+                gauges->active_sessions[i].store(services[i]->num_active_users, std::memory_order_relaxed);
+            }
+#endif
+        }
+
+        // number of customers that entered service across all services
+        long long NumInteractions() {
+            long long total = 0;
+            for (size_t i = 0; i < services.size(); i++)
+                total += services[i]->num_served;
+            return total;
+        }
+
+        // queueing results for every service
+        std::vector<ServiceMetrics> Metrics() {
+            std::vector<ServiceMetrics> metrics(services.size());
+            long long num_interactions = NumInteractions();
+            long long num_arrivals = 0;
+            double total_share = 0;
+            for (size_t i = 0; i < services.size(); i++) {
+                num_arrivals += services[i]->num_arrivals;
+                total_share += config.services[i].share;
+            }
+            for (size_t i = 0; i < services.size(); i++) {
+                StreamingService* s = services[i];
+                metrics[i].avg_cust_in_queue = LittlesLaw(sys_time, s->num_delays, s->AvgDelay());
+                metrics[i].queue_util = s->QueueUtil(sys_time);
+                metrics[i].num_delays = s->num_delays;
+                metrics[i].prob_delay = s->ProbDelay(num_interactions);
+                metrics[i].service_prob_delay = s->ServiceProbDelay();
+                metrics[i].avg_delay = s->AvgDelay();
+                metrics[i].max_delay = s->max_delay;
+                metrics[i].wait_p50 = s->wait_p50.Value();
+                metrics[i].wait_p95 = s->wait_p95.Value();
+                metrics[i].wait_p99 = s->wait_p99.Value();
+                metrics[i].avg_queue_length = s->queue_length.Mean(sys_time);
+                metrics[i].avg_busy_accounts = s->busy_accounts.Mean(sys_time);
+                metrics[i].offered_load = num_arrivals > 0 ? (double)s->offered_minutes / num_arrivals : NAN;
+                metrics[i].expected_offered_load = config.services[i].share / total_share * CustomerSampler::MeanServiceTime();
+                metrics[i].wait_histogram = s->wait_histogram.counts;
+            }
+            return metrics;
+        }
+
+    private:
+        int next_rollup_day = 0;                      // RunUntil hands finished days to the writer once it gets here
+};
+/*----------------------------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,378 @@
+/****************************************************************************************
+    snapshot.h
+
+    Snapshot of a warmed-up replication. Simulating up to arrival_of_last_customer is
+    the same for every account configuration only up to the point the configurations
+    start to differ, so a sweep can warm up once, save the complete state (customers,
+    services with their queues and active sessions, counters, statistics, pending events
+    and the per-customer random stream positions) and fork any number of scenarios from
+    it with different account counts or horizons. Forks share the seed and session
+    counters, so they are compared on common random numbers.
+
+    The file is memory-mapped on restore and every array is copied out in one block.
+    File layout (native byte order, every block padded to 8 bytes):
+        "MSSNAP04", SnapshotHeader
+        per service: SnapshotService, name bytes, queued ids (front first), active Sessions (heap order)
+        customer columns: arrival_time, service_time, depart_time, time_of_queue, delay_time,
+                          session (num_customers each), chosen_service (uint8)
+        pending events (num_pending_events Events, in heap order)
+****************************************************************************************/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "simulation.h"
+#include "replication.h"
+#include "thread_pool.h"
+
+const char snapshot_magic[8] = {'M', 'S', 'S', 'N', 'A', 'P', '0', '4'};
+
+struct SnapshotHeader {
+    uint64_t seed;
+    int32_t replication;
+    int32_t num_customers;
+    int32_t num_services;
+    int32_t num_months;             // horizon the snapshot was taken with
+    int32_t month_min;              // minutes per month, must match this build
+    int32_t sys_time;               // time of the last event handled
+    int32_t arrival_of_last_customer;
+    int32_t antithetic;             // 1 if the replication belongs to an antithetic pair
+    uint64_t num_pending_events;    // events in the event list, not yet handled
+};
+
+// one StreamingService without its name, queue and sessions
+struct SnapshotService {
+    double cost;
+    double share;
+    int32_t num_accounts;
+    int32_t num_active_users;
+    int64_t num_delays;
+    int64_t num_served;
+    int64_t num_arrivals;
+    int64_t num_queued;
+    int64_t offered_minutes;
+    int64_t total_delay;
+    int64_t time_in_queue;
+    int32_t max_delay;
+    uint32_t name_length;
+    uint32_t queue_length;
+    uint32_t num_sessions;
+    P2Quantile wait_p50;
+    P2Quantile wait_p95;
+    P2Quantile wait_p99;
+    TimeWeightedAverage queue_length_average;
+    TimeWeightedAverage busy_accounts_average;
+    int64_t wait_histogram[LogHistogram::num_buckets];
+};
+
+static_assert(std::is_trivially_copyable<SnapshotService>::value, "snapshot records are copied as raw bytes");
+static_assert(std::is_trivially_copyable<Event>::value, "snapshot records are copied as raw bytes");
+static_assert(std::is_trivially_copyable<Session>::value, "snapshot records are copied as raw bytes");
+
+
+/*--------------------------------SAVE--------------------------------*/
+// write n values and pad to a multiple of 8 bytes
+template <typename T>
+inline void WriteSnapshotBlock(FILE* file, const T* data, size_t n) {
+    static const char zeros[8] = {0};
+    size_t bytes = n * sizeof(T);
+    if (bytes > 0)
+        fwrite(data, 1, bytes, file);
+    if (bytes % 8 != 0)
+        fwrite(zeros, 1, 8 - bytes % 8, file);
+}
+
+// write the complete state of a simulation; returns false if the file cannot be written
+inline bool SaveSnapshot(const Simulation& sim, const std::string& path) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    WriteSnapshotBlock(file, snapshot_magic, sizeof(snapshot_magic));
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.seed = sim.seed;
+    header.replication = sim.replication;
+    header.num_customers = sim.customers.Size();
+    header.num_services = sim.services.size();
+    header.num_months = sim.config.num_months;
+    header.month_min = month_min;
+    header.sys_time = sim.sys_time;
+    header.arrival_of_last_customer = sim.arrival_of_last_customer;
+    header.antithetic = sim.config.antithetic ? 1 : 0;
+    header.num_pending_events = sim.events.heap.size();
+    WriteSnapshotBlock(file, &header, 1);
+
+    for (size_t i = 0; i < sim.services.size(); i++) {
+        const StreamingService* s = sim.services[i];
+        SnapshotService record = SnapshotService();
+        record.cost = s->cost;
+        record.share = sim.config.services[i].share;
+        record.num_accounts = s->num_accounts;
+        record.num_active_users = s->num_active_users;
+        record.num_delays = s->num_delays;
+        record.num_served = s->num_served;
+        record.num_arrivals = s->num_arrivals;
+        record.num_queued = s->num_queued;
+        record.offered_minutes = s->offered_minutes;
+        record.total_delay = s->total_delay;
+        record.time_in_queue = s->time_in_queue;
+        record.max_delay = s->max_delay;
+        record.name_length = s->name.size();
+        record.queue_length = s->service_queue.size();
+        record.num_sessions = s->Sessions().size();
+        record.wait_p50 = s->wait_p50;
+        record.wait_p95 = s->wait_p95;
+        record.wait_p99 = s->wait_p99;
+        record.queue_length_average = s->queue_length;
+        record.busy_accounts_average = s->busy_accounts;
+        for (int k = 0; k < LogHistogram::num_buckets; k++)
+            record.wait_histogram[k] = s->wait_histogram.counts[k];
+        WriteSnapshotBlock(file, &record, 1);
+        WriteSnapshotBlock(file, s->name.data(), s->name.size());
+        std::vector<int> queued(s->service_queue.size());   // front first, unwrapped from the ring buffer
+        for (size_t i = 0; i < queued.size(); i++)
+            queued[i] = s->service_queue.at(i);
+        WriteSnapshotBlock(file, queued.data(), queued.size());
+        WriteSnapshotBlock(file, s->Sessions().data(), s->Sessions().size());
+    }
+
+    const CustomerTable& c = sim.customers;
+    size_t n = c.Size();
+    WriteSnapshotBlock(file, c.arrival_time.data(), n);
+    WriteSnapshotBlock(file, c.service_time.data(), n);
+    WriteSnapshotBlock(file, c.depart_time.data(), n);
+    WriteSnapshotBlock(file, c.time_of_queue.data(), n);
+    WriteSnapshotBlock(file, c.delay_time.data(), n);
+    WriteSnapshotBlock(file, c.session.data(), n);
+    WriteSnapshotBlock(file, c.chosen_service.data(), n);
+    WriteSnapshotBlock(file, sim.events.heap.data(), sim.events.heap.size());
+    bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
+/*--------------------------------------------------------------------*/
+
+
+/*--------------------------------RESTORE--------------------------------*/
+// read position in a mapped snapshot; each restore has its own, so forks can restore concurrently
+struct SnapshotCursor {
+    const char* data;
+    size_t size;
+    size_t offset;
+
+    // the next block of n values, or NULL if the file is too short
+    template <typename T>
+    const T* Take(size_t n) {
+        if (n > size / sizeof(T))
+            return NULL;
+        size_t bytes = n * sizeof(T);
+        size_t padded = (bytes + 7) / 8 * 8;
+        if (offset > size || padded > size - offset)
+            return NULL;
+        const T* p = (const T*)(data + offset);
+        offset += padded;
+        return p;
+    }
+
+    template <typename T>
+    bool Copy(std::vector<T>& out, size_t n) {
+        const T* p = Take<T>(n);
+        if (p == NULL)
+            return false;
+        out.assign(p, p + n);
+        return true;
+    }
+};
+
+// a snapshot file mapped read-only into memory
+class SimulationSnapshot {
+    public:
+        // constructor, maps the file and checks its header
+        SimulationSnapshot(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    data = (const char*)p;
+                    size = st.st_size;
+                }
+            }
+            close(fd);
+            if (data == NULL)
+                return;
+            SnapshotCursor cursor = {data, size, 0};
+            const char* magic = cursor.Take<char>(sizeof(snapshot_magic));
+            const SnapshotHeader* h = cursor.Take<SnapshotHeader>(1);
+            if (magic == NULL || memcmp(magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || h == NULL
+                || h->month_min != month_min || h->num_customers <= 0 || h->num_services <= 0 || h->num_services > 256)
+                return;
+            header = *h;
+            body = cursor.offset;
+            valid = true;
+        }
+
+        // destructor
+        ~SimulationSnapshot() {
+            if (data != NULL)
+                munmap((void*)data, size);
+        }
+
+        SimulationSnapshot(const SimulationSnapshot&) = delete;
+        SimulationSnapshot& operator=(const SimulationSnapshot&) = delete;
+
+        bool IsOpen() const {
+            return valid;
+        }
+
+        const SnapshotHeader& Header() const {
+            return header;
+        }
+
+        // the configuration the snapshot was taken with; forks change its accounts or num_months
+        SimulationConfig Config() const {
+            SimulationConfig config;
+            config.num_customers = header.num_customers;
+            config.num_months = header.num_months;
+            config.antithetic = header.antithetic != 0;
+            config.services.clear();
+            config.accounts.clear();
+            SnapshotCursor cursor = {data, size, body};
+            for (int i = 0; i < header.num_services && valid; i++) {
+                const SnapshotService* record = cursor.Take<SnapshotService>(1);
+                const char* name = record ? cursor.Take<char>(record->name_length) : NULL;
+                if (record == NULL || name == NULL || cursor.Take<int>(record->queue_length) == NULL || cursor.Take<Session>(record->num_sessions) == NULL)
+                    break;
+                config.services.push_back({std::string(name, record->name_length), record->cost, record->share});
+                config.accounts.push_back(record->num_accounts);
+            }
+            return config;
+        }
+
+        // fill a simulation built with initialize_customers = false from the same seed, replication
+        // and catalog; its accounts and horizon may differ from the snapshot's. Returns false if
+        // the snapshot does not fit the simulation or is truncated.
+        bool Restore(Simulation& sim) const {
+            if (!IsOpen() || sim.seed != header.seed || sim.replication != header.replication
+                || sim.customers.Size() != header.num_customers || (int)sim.services.size() != header.num_services)
+                return false;
+            SnapshotCursor cursor = {data, size, body};
+            for (int i = 0; i < header.num_services; i++) {
+                StreamingService* s = sim.services[i];
+                const SnapshotService* record = cursor.Take<SnapshotService>(1);
+                if (record == NULL)
+                    return false;
+                const char* name = cursor.Take<char>(record->name_length);
+                const int* queued = cursor.Take<int>(record->queue_length);
+                const Session* sessions = cursor.Take<Session>(record->num_sessions);
+                if (name == NULL || queued == NULL || sessions == NULL || std::string(name, record->name_length) != s->name)
+                    return false;
+                for (uint32_t k = 0; k < record->queue_length; k++) {
+                    if (!IsCustomer(queued[k]))
+                        return false;
+                }
+                for (uint32_t k = 0; k < record->num_sessions; k++) {
+                    if (!IsCustomer(sessions[k].cust_id))
+                        return false;
+                }
+                s->num_active_users = record->num_active_users;
+                s->num_delays = record->num_delays;
+                s->num_served = record->num_served;
+                s->num_arrivals = record->num_arrivals;
+                s->num_queued = record->num_queued;
+                s->offered_minutes = record->offered_minutes;
+                s->total_delay = record->total_delay;
+                s->time_in_queue = record->time_in_queue;
+                s->max_delay = record->max_delay;
+                s->wait_p50 = record->wait_p50;
+                s->wait_p95 = record->wait_p95;
+                s->wait_p99 = record->wait_p99;
+                s->queue_length = record->queue_length_average;
+                s->busy_accounts = record->busy_accounts_average;
+                for (int k = 0; k < LogHistogram::num_buckets; k++)
+                    s->wait_histogram.counts[k] = record->wait_histogram[k];
+                s->service_queue.assign(queued, record->queue_length);
+                s->AssignSessions(sessions, record->num_sessions);
+            }
+
+            CustomerTable& c = sim.customers;
+            size_t n = header.num_customers;
+            if (!cursor.Copy(c.arrival_time, n) || !cursor.Copy(c.service_time, n) || !cursor.Copy(c.depart_time, n)
+                || !cursor.Copy(c.time_of_queue, n) || !cursor.Copy(c.delay_time, n)
+                || !cursor.Copy(c.session, n) || !cursor.Copy(c.chosen_service, n) || !cursor.Copy(sim.events.heap, header.num_pending_events))
+                return false;
+            // the file's ids index the customer table and the services; check them before anything uses them
+            for (size_t i = 0; i < n; i++) {
+                if (c.chosen_service[i] >= header.num_services)
+                    return false;
+            }
+            for (size_t i = 0; i < sim.events.heap.size(); i++) {
+                const Event& ev = sim.events.heap[i];
+                if (!IsCustomer(ev.cust_id) || ev.service < 0 || ev.service >= header.num_services || (ev.type != ARRIVAL && ev.type != DEPARTURE))
+                    return false;
+            }
+            sim.sys_time = header.sys_time;
+            sim.arrival_of_last_customer = header.arrival_of_last_customer;
+            return true;
+        }
+
+    private:
+        const char* data = NULL;
+        size_t size = 0;
+        bool valid = false;         // mapped and the header checks out
+        size_t body = 0;            // offset of the first service record
+        SnapshotHeader header;
+
+        bool IsCustomer(int cust_id) const {
+            return cust_id >= 0 && cust_id < header.num_customers;
+        }
+};
+
+// resume the snapshot under 'config' (its accounts and num_months; the catalog and number of
+// customers must match the snapshot) and run it to the end; NULL if the snapshot does not fit
+inline Simulation* ForkSimulation(const SimulationSnapshot& snapshot, const SimulationConfig& config, TransactionLogWriter* transactions = NULL,
+                                  RollupWriter* rollups = NULL) {
+    const SnapshotHeader& h = snapshot.Header();
+    Simulation* sim = new Simulation(h.seed, h.replication, config, transactions, false);
+    if (!snapshot.Restore(*sim)) {
+        delete sim;
+        return NULL;
+    }
+    if (rollups != NULL)
+        sim->SetRollups(rollups);       // windows start at the snapshot's time
+    sim->Run();
+    return sim;
+}
+
+// fork one scenario per configuration on the pool; the results of a scenario that does not fit
+// the snapshot are left empty
+inline std::vector<ReplicationResults> ForkScenarios(const SimulationSnapshot& snapshot, const std::vector<SimulationConfig>& configs, ThreadPool& pool) {
+    std::vector<ReplicationResults> results(configs.size());
+    for (size_t k = 0; k < configs.size(); k++) {
+        pool.Submit([&snapshot, &configs, &results, k] {
+            Simulation* sim = ForkSimulation(snapshot, configs[k]);
+            if (sim == NULL)
+                return;
+            results[k].metrics.push_back(sim->Metrics());
+            results[k].arrival_of_last_customer = sim->arrival_of_last_customer;
+            results[k].sys_time = sim->sys_time;
+            delete sim;
+        });
+    }
+    pool.Wait();
+    return results;
+}
+/*-----------------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,251 @@
+/****************************************************************************************
+    surrogate_model.h
+
+    Analytical stand-in for the simulation, to screen account vectors before simulating
+    them. The arrival rate over the run follows from the model's constants alone: every
+    customer's first arrival comes from the arrival windows seen at time 0 plus its id
+    times config.arrival_spacing, and after that it returns one session plus one
+    arrival-window gap later (a renewal process on 10-minute bins). The few whose next
+    arrival lands on the very minute they leave are dropped, as the engine does. The rate
+    is split among the services by their shares, and each service is taken to be
+    stationary for an hour at a time.
+
+    A customer that finds every account busy queues, and leaves the queue, without being
+    served, when the next session ends; the freed account goes to the next arrival. So
+    the accounts form a loss system: the share of arrivals that queue is Erlang B of the
+    offered load, which holds for any session length distribution. While the queue is not
+    empty the accounts alternate between full (sessions end at c*mu) and one short (until
+    the next arrival, at lambda), so queued customers leave at c*mu and join at
+    lambda^2 / (lambda + c*mu). That makes the wait exponential. A wait counts as a delay
+    only once it crosses a minute boundary, as it does in the engine's whole-minute clock.
+    If the queue grows faster than departures clear it, the backlog carries over into
+    later hours. Customers that queue skip their session, so they come back sooner; the
+    arrival profile is recomputed once with that share.
+****************************************************************************************/
+
+#ifndef SURROGATE_MODEL_H
+#define SURROGATE_MODEL_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "simulation.h"
+
+const int surrogate_bin = 10;               // minutes per bin of the arrival profile
+const int surrogate_interval = 60;          // minutes each service is taken to be stationary over
+
+// predicted end-of-run results for one streaming service, defined like ServiceMetrics
+struct SurrogatePrediction {
+    double offered_load;        // mean accounts asked for over the run (Erlangs)
+    double utilization;         // offered load / accounts
+    double prob_delay;          // arrivals that found every account busy / this service's arrivals, like ServiceMetrics::service_prob_delay
+    double avg_delay;           // mean wait of the customers that waited (mins)
+};
+
+// one service's predicted totals over the run
+struct SurrogateQueue {
+    double arrivals = 0;
+    double queued = 0;              // arrivals that found every account busy
+    double delayed = 0;             // of those, the ones that waited into a later minute
+    double delay_minutes = 0;       // total wait of the delayed
+};
+
+class SurrogateModel {
+    public:
+        // constructor, prepares the gap and first-arrival distributions of config's customers and horizon
+        SurrogateModel(const SimulationConfig& config) : config(config) {
+            double total_share = 0;
+            for (int i = 0; i < config.NumServices(); i++)
+                total_share += config.services[i].share;
+            for (int i = 0; i < config.NumServices(); i++)
+                shares.push_back(config.services[i].share / total_share);
+            mean_service_time = CustomerSampler::MeanServiceTime();
+
+            // gap from leaving service to the next arrival, for a departure minute uniform within the hour;
+            // a customer arriving on the minute it leaves is dropped, so that share of the mass never returns
+            for (int m = 0; m < 60; m++)
+                AddGaps(m*24, 1.0 / 60, gap);                   // time_of_day = sys_time % 60*24
+            gap[0] = 0;
+
+            // first arrivals: customer i arrives (int)(i * arrival_spacing) minutes after the windows seen at time 0
+            int end_time = config.num_months * month_min;
+            int num_bins = (end_time + surrogate_bin - 1) / surrogate_bin;
+            std::vector<double> first_gap;
+            AddGaps(0, 1.0, first_gap);
+            std::vector<double> gap_cdf(first_gap.size());
+            for (size_t g = 0; g < first_gap.size(); g++)
+                gap_cdf[g] = first_gap[g] + (g > 0 ? gap_cdf[g-1] : 0);
+            std::vector<double> offsets(end_time, 0);           // customers whose windows start at each minute
+            for (int i = 0; i < config.num_customers; i++) {
+                int offset = (int)(i * config.arrival_spacing);
+                if (offset >= end_time)
+                    break;
+                offsets[offset]++;
+            }
+            first_arrivals.assign(num_bins, 0);
+            for (int b = 0; b < num_bins; b++) {
+                // customers with offset + gap in this bin's minutes
+                int first = b * surrogate_bin, last = std::min(end_time, (b + 1) * surrogate_bin) - 1;
+                for (int o = std::max(0, first - (int)gap_cdf.size() + 1); o <= last; o++) {
+                    if (offsets[o] > 0)
+                        first_arrivals[b] += offsets[o] * (Cdf(gap_cdf, last - o) - Cdf(gap_cdf, first - 1 - o));
+                }
+            }
+        }
+
+        // predictions for every service with the given accounts
+        std::vector<SurrogatePrediction> Predict(const std::vector<int>& accounts) const {
+            std::vector<double> arrivals = Solve(accounts);
+            std::vector<SurrogatePrediction> predictions(config.NumServices());
+            double end_time = config.num_months * (double)month_min;
+            for (int i = 0; i < config.NumServices(); i++) {
+                SurrogateQueue q = Queue(arrivals, i, accounts[i]);
+                predictions[i].offered_load = q.arrivals * mean_service_time / end_time;
+                predictions[i].utilization = accounts[i] > 0 ? predictions[i].offered_load / accounts[i] : INFINITY;
+                predictions[i].prob_delay = q.arrivals > 0 ? q.queued / q.arrivals : NAN;
+                predictions[i].avg_delay = q.delayed > 0 ? q.delay_minutes / q.delayed : NAN;
+            }
+            return predictions;
+        }
+
+        // fewest accounts predicted to keep the probability of queue of the service's own arrivals below
+        // max_prob_delay, with the other services at their counts in 'accounts' (which shape the arrivals)
+        int MinimumAccounts(int service, double max_prob_delay, const std::vector<int>& accounts) const {
+            std::vector<double> arrivals = Solve(accounts);
+            // the probability of queue falls as accounts are added, so gallop and bisect
+            int lo = 0, hi = 1;
+            while (hi < config.num_customers && !Meets(arrivals, service, hi, max_prob_delay)) {
+                lo = hi;
+                hi *= 2;
+            }
+            hi = std::min(hi, config.num_customers);
+            while (hi - lo > 1) {
+                int mid = lo + (hi - lo) / 2;
+                if (Meets(arrivals, service, mid, max_prob_delay))
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            return hi;
+        }
+
+    private:
+        SimulationConfig config;
+        std::vector<double> shares;                 // normalized service choice probabilities
+        double mean_service_time;
+        std::vector<double> gap;                    // pmf of the minutes from leaving to the next arrival, drops removed
+        std::vector<double> first_arrivals;         // expected first arrivals in each bin
+
+        // expected arrivals in each bin, all services, when a 'queued' share of arrivals skips its session
+        // and waits 'wait' minutes instead
+        std::vector<double> ArrivalProfile(double queued, double wait) const {
+            // cycle length from one arrival to the next, binned
+            std::vector<double> cycle;
+            for (size_t g = 0; g < gap.size(); g++) {
+                if (gap[g] == 0)
+                    continue;
+                for (int s = 0; s <= service_time_spread; s++) {
+                    double length = s < service_time_spread ? g + min_service_time + s : g + wait;
+                    double p = s < service_time_spread ? (1 - queued) / service_time_spread : queued;
+                    size_t k = std::max(1L, std::lround(length / surrogate_bin));
+                    if (k >= cycle.size())
+                        cycle.resize(k + 1, 0);
+                    cycle[k] += gap[g] * p;
+                }
+            }
+            // every arrival starts a cycle that ends in the next one
+            std::vector<double> arrivals = first_arrivals;
+            for (size_t b = 0; b < arrivals.size(); b++) {
+                for (size_t k = 1; k < cycle.size() && k <= b; k++)
+                    arrivals[b] += arrivals[b - k] * cycle[k];
+            }
+            return arrivals;
+        }
+
+        // the arrival profile with the share of queued arrivals the given accounts lead to
+        std::vector<double> Solve(const std::vector<int>& accounts) const {
+            std::vector<double> arrivals = ArrivalProfile(0, 0);
+            double total = 0, queued = 0, wait = 0;
+            for (int i = 0; i < config.NumServices(); i++) {
+                SurrogateQueue q = Queue(arrivals, i, accounts[i]);
+                total += q.arrivals;
+                queued += q.queued;
+                wait += q.delay_minutes;
+            }
+            if (queued <= 0)
+                return arrivals;
+            return ArrivalProfile(queued / total, wait / queued);
+        }
+
+        // run one service with the given accounts through every interval of the arrival profile
+        SurrogateQueue Queue(const std::vector<double>& arrivals, int service, int accounts) const {
+            const int per_interval = surrogate_interval / surrogate_bin;
+            SurrogateQueue q;
+            double mu = 1.0 / mean_service_time;
+            double capacity = accounts * mu;                    // sessions ending per minute with every account busy
+            double backlog = 0;                                 // customers still queued from overloaded intervals
+            for (size_t start = 0; start < arrivals.size(); start += per_interval) {
+                double arriving = 0;
+                for (size_t b = start; b < start + per_interval && b < arrivals.size(); b++)
+                    arriving += shares[service] * arrivals[b];
+                double lambda = arriving / surrogate_interval;
+                q.arrivals += arriving;
+                if (arriving <= 0)
+                    continue;
+                double blocking = accounts > 0 ? ErlangB(accounts, lambda / mu) : 1;
+                double queued = arriving * blocking;
+                q.queued += queued;
+                double joining = lambda * lambda / (lambda + capacity);    // per minute while the queue is not empty
+                double rate = capacity - joining;                          // of the exponential wait
+                if (backlog > 0 || rate <= 0) {
+                    // fluid approximation: everyone queued waits behind the backlog
+                    double next = std::max(0.0, backlog + (joining - capacity) * surrogate_interval);
+                    q.delayed += queued;
+                    q.delay_minutes += queued * (1 + (capacity > 0 ? (backlog + next) / 2 / capacity : surrogate_interval));
+                    backlog = next;
+                    continue;
+                }
+                // a wait T ~ exp(rate) from a uniform point in a minute crosses into a later minute with
+                // probability (1 - e^-rate) / rate, and its whole minutes average 1 / rate
+                q.delayed += queued * (1 - std::exp(-rate)) / rate;
+                q.delay_minutes += queued / rate;
+            }
+            return q;
+        }
+
+        // add the pmf (scaled by weight) of the gap between leaving service at time_of_day and the next
+        // arrival, following CustomerSampler::ArrivalTime
+        static void AddGaps(int time_of_day, double weight, std::vector<double>& gap) {
+            const ArrivalWindow* windows = time_of_day < 60*12 ? morning_windows : afternoon_windows;
+            const double* window_shares = time_of_day < 60*12 ? morning_window_shares : afternoon_window_shares;
+            for (int w = 0; w < 3; w++) {
+                int start = windows[w].start == from_time_of_day ? time_of_day : windows[w].start;
+                int end = windows[w].end;
+                if ((int)gap.size() <= end - time_of_day)
+                    gap.resize(end - time_of_day + 1, 0);
+                for (int x = start; x <= end; x++)
+                    gap[x - time_of_day] += weight * window_shares[w] / (end - start + 1);
+            }
+        }
+
+        static double Cdf(const std::vector<double>& cdf, int x) {
+            if (x < 0)
+                return 0;
+            return x < (int)cdf.size() ? cdf[x] : cdf.back();
+        }
+
+        // probability that an arrival finds all c servers busy in a loss system with offered load a (Erlangs)
+        static double ErlangB(int c, double a) {
+            double b = 1;
+            for (int k = 1; k <= c; k++)
+                b = a * b / (k + a * b);
+            return b;
+        }
+
+        bool Meets(const std::vector<double>& arrivals, int service, int accounts, double max_prob_delay) const {
+            SurrogateQueue q = Queue(arrivals, service, accounts);
+            return q.arrivals <= 0 || q.queued / q.arrivals < max_prob_delay;
+        }
+};
+
+#endif
@@ -0,0 +1,96 @@
+/****************************************************************************************
+    thread_pool.h
+
+    A fixed-size pool of worker threads. Tasks are queued with Submit() and picked up
+    by whichever worker is free; Wait() blocks until every queued task has finished.
+****************************************************************************************/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+
+class ThreadPool {
+    public:
+        // constructor, num_threads <= 0 uses every core
+        ThreadPool(int num_threads = 0) {
+            if (num_threads <= 0)
+                num_threads = DefaultThreads();
+            for (int i = 0; i < num_threads; i++)
+                workers.emplace_back([this] { WorkerLoop(); });
+        }
+
+        // destructor, finishes the queued tasks and joins the workers
+        ~ThreadPool() {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            task_ready.notify_all();
+            for (size_t i = 0; i < workers.size(); i++)
+                workers[i].join();
+        }
+
+        // number of hardware threads, at least one
+        static int DefaultThreads() {
+            int n = (int)std::thread::hardware_concurrency();
+            return n > 0 ? n : 1;
+        }
+
+        int NumThreads() const {
+            return (int)workers.size();
+        }
+
+        // queue a task to run on the next free worker
+        void Submit(std::function<void()> task) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                tasks.push(std::move(task));
+                num_pending++;
+            }
+            task_ready.notify_one();
+        }
+
+        // block until every submitted task has finished
+        void Wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            all_done.wait(lock, [this] { return num_pending == 0; });
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable task_ready;
+        std::condition_variable all_done;
+        int num_pending = 0;                          // tasks queued or running
+        bool stopping = false;
+
+        void WorkerLoop() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    task_ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    num_pending--;
+                    if (num_pending == 0)
+                        all_done.notify_all();
+                }
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,324 @@
+/****************************************************************************************
+    transaction_log.h
+
+    Binary transaction log. The simulation loop appends fixed-size TransactionRecords to
+    a lock-free single-producer/single-consumer ring buffer; a background thread drains
+    it into a compact columnar file made of row groups (each column stored contiguously).
+    ExportTransactionsCsv() renders such a file as the transactions.csv columns on demand,
+    formatting dates into a stack buffer instead of building strings.
+
+    File layout (native byte order):
+        "MSTXLOG1", uint32 minutes per month, uint32 num_services, then per service: uint32 length, name bytes
+        row groups: uint32 rows, int32 cust_id[rows], uint8 service[rows], int32 arrival[rows],
+                    int32 depart[rows], int32 service_time[rows], int32 delay[rows]
+****************************************************************************************/
+
+#ifndef TRANSACTION_LOG_H
+#define TRANSACTION_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include "instrumentation.h"
+
+// one departure, as written to transactions.csv
+struct TransactionRecord {
+    int32_t cust_id;
+    int32_t service;            // index into service_names
+    int32_t arrival_time;
+    int32_t depart_time;
+    int32_t service_time;
+    int32_t delay_time;
+};
+
+const char transaction_log_magic[8] = {'M', 'S', 'T', 'X', 'L', 'O', 'G', '1'};
+
+
+/*--------------------------------RING BUFFER--------------------------------*/
+// bounded lock-free queue between exactly one producer and one consumer thread
+class TransactionRingBuffer {
+    public:
+        // constructor, capacity is rounded up to a power of two
+        TransactionRingBuffer(size_t capacity) {
+            size_t n = 1;
+            while (n < capacity)
+                n <<= 1;
+            records.resize(n);
+            mask = n - 1;
+        }
+
+        // producer: false if the buffer is full
+        bool TryPush(const TransactionRecord& record) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) > mask)
+                return false;
+            records[t & mask] = record;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer: copy up to max_count records into out, returns how many were copied
+        size_t PopBatch(TransactionRecord* out, size_t max_count) {
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t available = tail.load(std::memory_order_acquire) - h;
+            size_t n = std::min(available, max_count);
+            for (size_t i = 0; i < n; i++)
+                out[i] = records[(h + i) & mask];
+            head.store(h + n, std::memory_order_release);
+            return n;
+        }
+
+    private:
+        std::vector<TransactionRecord> records;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head{0};      // next record to pop (consumer)
+        alignas(64) std::atomic<size_t> tail{0};      // next free slot (producer)
+};
+/*---------------------------------------------------------------------------*/
+
+
+/*--------------------------------LOG WRITER--------------------------------*/
+// owns the ring buffer and the background thread that writes it to disk
+class TransactionLogWriter {
+    public:
+        static const size_t rows_per_group = 1 << 16;
+
+        // constructor, opens the file, writes the service names and the month length used for
+        // rendering dates, and starts the writer thread
+        TransactionLogWriter(const std::string& path, const std::vector<std::string>& names, int minutes_per_month, size_t ring_capacity = 1 << 16)
+            : ring(ring_capacity) {
+            file = fopen(path.c_str(), "wb");
+            if (file == NULL)
+                return;
+            fwrite(transaction_log_magic, 1, sizeof(transaction_log_magic), file);
+            uint32_t month = minutes_per_month;
+            fwrite(&month, sizeof(month), 1, file);
+            uint32_t count = names.size();
+            fwrite(&count, sizeof(count), 1, file);
+            for (size_t i = 0; i < names.size(); i++) {
+                uint32_t length = names[i].size();
+                fwrite(&length, sizeof(length), 1, file);
+                fwrite(names[i].data(), 1, length, file);
+            }
+            writer = std::thread([this] { WriterLoop(); });
+        }
+
+        // destructor, flushes whatever is still buffered
+        ~TransactionLogWriter() {
+            Close();
+        }
+
+        bool IsOpen() const {
+            return file != NULL;
+        }
+
+        // called from the simulation loop; only waits if the writer has fallen a whole ring behind
+        void Append(const TransactionRecord& record) {
+            INSTRUMENT_PHASE(PHASE_LOGGING);
+            while (!ring.TryPush(record))
+                std::this_thread::yield();
+        }
+
+        // drain the ring, write the last row group and close the file
+        void Close() {
+            if (file == NULL)
+                return;
+            closing.store(true, std::memory_order_release);
+            writer.join();
+            fclose(file);
+            file = NULL;
+        }
+
+        // bytes written to the file so far (valid after Close)
+        long long BytesWritten() const {
+            return bytes_written;
+        }
+
+    private:
+        TransactionRingBuffer ring;
+        FILE* file = NULL;
+        std::thread writer;
+        std::atomic<bool> closing{false};
+        long long bytes_written = 0;
+        // the row group being filled, one vector per column
+        std::vector<int32_t> cust_id, arrival, depart, service_time, delay;
+        std::vector<uint8_t> service;
+
+        void WriterLoop() {
+            std::vector<TransactionRecord> batch(4096);
+            while (true) {
+                bool done = closing.load(std::memory_order_acquire);      // read before draining so nothing is missed
+                size_t n = ring.PopBatch(batch.data(), batch.size());
+                for (size_t i = 0; i < n; i++) {
+                    cust_id.push_back(batch[i].cust_id);
+                    service.push_back((uint8_t)batch[i].service);
+                    arrival.push_back(batch[i].arrival_time);
+                    depart.push_back(batch[i].depart_time);
+                    service_time.push_back(batch[i].service_time);
+                    delay.push_back(batch[i].delay_time);
+                    if (cust_id.size() == rows_per_group)
+                        WriteGroup();
+                }
+                if (n == 0) {
+                    if (done)
+                        break;
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            }
+            WriteGroup();
+            bytes_written = ftell(file);
+        }
+
+        template <typename T>
+        void WriteColumn(std::vector<T>& column) {
+            fwrite(column.data(), sizeof(T), column.size(), file);
+            column.clear();
+        }
+
+        void WriteGroup() {
+            uint32_t rows = cust_id.size();
+            if (rows == 0)
+                return;
+            fwrite(&rows, sizeof(rows), 1, file);
+            WriteColumn(cust_id);
+            WriteColumn(service);
+            WriteColumn(arrival);
+            WriteColumn(depart);
+            WriteColumn(service_time);
+            WriteColumn(delay);
+        }
+};
+/*--------------------------------------------------------------------------*/
+
+
+/*--------------------------------CSV EXPORTER--------------------------------*/
+// append a decimal integer, returns the new end of the buffer
+inline char* AppendInt(char* out, long long value) {
+    if (value < 0) {
+        *out++ = '-';
+        value = -value;
+    }
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+// append a value with at least two digits (leading zero), like StreamingService::StringTime
+inline char* AppendTwoDigits(char* out, int value) {
+    if (value >= 0 && value < 10)
+        *out++ = '0';
+    return AppendInt(out, value);
+}
+
+// append the time as month-day hours:minutes, the same text as StreamingService::GetDateTime
+inline char* AppendDateTime(char* out, int time, int month_min) {
+    int months = time / month_min;
+    int days = (time - months*month_min) / (24*60);
+    int hours = (time - months*month_min - days*24*60) / 60;
+    int minutes = time - months*month_min - days*24*60 - hours*60;
+    out = AppendTwoDigits(out, months+1);
+    *out++ = '/';
+    out = AppendTwoDigits(out, days+1);
+    memcpy(out, "/2023 ", 6);
+    out += 6;
+    out = AppendTwoDigits(out, hours);
+    *out++ = ':';
+    return AppendTwoDigits(out, minutes);
+}
+
+// render a binary transaction log as transactions.csv; returns false if it cannot be read
+inline bool ExportTransactionsCsv(const std::string& in_path, const std::string& out_path) {
+    FILE* in = fopen(in_path.c_str(), "rb");
+    if (in == NULL)
+        return false;
+    char magic[sizeof(transaction_log_magic)];
+    uint32_t month_min = 0;
+    uint32_t count = 0;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, transaction_log_magic, sizeof(magic)) != 0
+        || fread(&month_min, sizeof(month_min), 1, in) != 1 || month_min == 0 || fread(&count, sizeof(count), 1, in) != 1) {
+        fclose(in);
+        return false;
+    }
+    std::vector<std::string> names(count);
+    size_t longest_name = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t length = 0;
+        if (fread(&length, sizeof(length), 1, in) != 1) {
+            fclose(in);
+            return false;
+        }
+        names[i].resize(length);
+        if (length > 0 && fread(&names[i][0], 1, length, in) != length) {
+            fclose(in);
+            return false;
+        }
+        longest_name = std::max<size_t>(longest_name, length);
+    }
+
+    FILE* out = fopen(out_path.c_str(), "wb");
+    if (out == NULL) {
+        fclose(in);
+        return false;
+    }
+    const char* header = "Customer Id, Service Name, Time Of Arrival, Time Of Departure, Minutes In Service, Minutes In Queue\n";
+    fwrite(header, 1, strlen(header), out);
+
+    std::vector<int32_t> cust_id, arrival, depart, service_time, delay;
+    std::vector<uint8_t> service;
+    std::vector<char> text;
+    uint32_t rows;
+    bool ok = true;
+    while (fread(&rows, sizeof(rows), 1, in) == 1) {
+        cust_id.resize(rows);
+        service.resize(rows);
+        arrival.resize(rows);
+        depart.resize(rows);
+        service_time.resize(rows);
+        delay.resize(rows);
+        if (fread(cust_id.data(), sizeof(int32_t), rows, in) != rows || fread(service.data(), 1, rows, in) != rows
+            || fread(arrival.data(), sizeof(int32_t), rows, in) != rows || fread(depart.data(), sizeof(int32_t), rows, in) != rows
+            || fread(service_time.data(), sizeof(int32_t), rows, in) != rows || fread(delay.data(), sizeof(int32_t), rows, in) != rows) {
+            ok = false;
+            break;
+        }
+        // a row is at most ~110 characters plus the service name
+        text.resize((size_t)rows * (128 + longest_name));
+        char* p = text.data();
+        for (uint32_t r = 0; r < rows; r++) {
+            p = AppendInt(p, cust_id[r]);
+            *p++ = ','; *p++ = ' ';
+            if (service[r] < names.size()) {
+                memcpy(p, names[service[r]].data(), names[service[r]].size());
+                p += names[service[r]].size();
+            }
+            *p++ = ','; *p++ = ' ';
+            p = AppendDateTime(p, arrival[r], month_min);
+            *p++ = ','; *p++ = ' ';
+            p = AppendDateTime(p, depart[r], month_min);
+            *p++ = ','; *p++ = ' ';
+            p = AppendInt(p, service_time[r]);
+            *p++ = ','; *p++ = ' ';
+            p = AppendInt(p, delay[r]);
+            *p++ = '\n';
+        }
+        fwrite(text.data(), 1, p - text.data(), out);
+    }
+    fclose(in);
+    fclose(out);
+    return ok;
+}
+/*----------------------------------------------------------------------------*/
+
+#endif